@@ -21,15 +21,57 @@
  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *******************************************************************************/
 
-#include <new>
-
 //#define DEBUG//uncomment this line to print serial messages, comment to send MIDI data
 //#define BLUETOOTH//uncomment this line to send MIDI data via bluetooth instead of USB
 //#define BMP//uncomment this line to use the BMP180 to add dynamics via bellows
 //#define JOYSTICK//uncomment this line to use a joystick as a pitch-bend controller
+//#define EXPRESSION_14BIT//uncomment this line to send the expression as 14-bit (CC11 then CC43 for the fine part)
+//#define EXPRESSION_NRPN//uncomment this line to send the expression as the 14-bit NRPN EXPRESSION_NRPN_PARAMETER
+//#define RUNNING_STATUS//uncomment this line to leave out repeated MIDI status bytes (still resent every 100 ms)
+//#define NO_DEBOUNCE//uncomment this line to send the raw key readings without debouncing
+//#define TIMER_SCAN//uncomment this line to scan the keys from a timer interrupt, every SCAN_PERIOD_US
+//#define DIGITALWRITE_MATRIX//uncomment this line to drive the key matrix with digitalWrite instead of direct port writes
+//#define STATS//uncomment this line to collect timing counters, sent in reply to a 0x0C SysEx
+//#define TRACE//uncomment this line to record the last key and MIDI events, sent in reply to a 0x0D SysEx
 
+#include "hal.h"
 #include "midi.h"
+#include "midi_out.hpp"
 #include "keyboard.hpp"
+#include "presets.hpp"
+#include "matrix.hpp"
+#include "debounce.hpp"
+#include "controllers.hpp"
+#include "upload.hpp"
+#ifdef BMP
+#include "bellows.hpp"
+#endif
+#ifdef STATS
+#include "stats.hpp"
+#endif
+#ifdef TRACE
+#include "trace.hpp"
+#endif
+
+// Time to scan the whole matrix with TIMER_SCAN
+#define SCAN_PERIOD_US 1200
+// Maximum number of incoming bytes parsed per loop while receiving a long
+// SysEx, so that the keys are still scanned in between
+#define SYSEX_BYTES_PER_LOOP 16
+// Maximum number of buttons sent in reply to a single 0x08 SysEx
+#define GET_BUTTONS_MAX 24
+// Continuous controllers: changes smaller than the hysteresis (in 14-bit
+// units) are not sent, nor two messages closer than the interval. A 7-bit
+// expression step is 128.
+#if defined(EXPRESSION_NRPN) || defined(EXPRESSION_14BIT)
+#define EXPRESSION_HYSTERESIS 16
+#else
+#define EXPRESSION_HYSTERESIS 128
+#endif
+#define EXPRESSION_INTERVAL_MS 10
+#define PITCH_BEND_HYSTERESIS 64
+#define PITCH_BEND_INTERVAL_MS 10
+#define EXPRESSION_NRPN_PARAMETER 0x000B
 
 /*
  * We have 81 + 96 = 177 keys. We thus need a 12x16 grid.
@@ -41,47 +83,79 @@
  * We use PINC (pins D37-D30) for reading left keyboard.
  */
 
-// array to store up/down status of left keys
-// there is room for 12*8=96 buttons
-int LeftKeysStatus[] = {
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000
-};
-
-// array to store up/down status of right keys
-// there is room for 12*8=96 buttons
-int right_keys_status[] = {
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000,
-  B0000000
-};
+// up/down status of the keys, diffed after each full scan
+Matrix matrix;
+#ifdef TIMER_SCAN
+// keys changed, found by the timer interrupt
+KeyEventQueue key_event_queue;
+#else
+KeyEvent key_events[MAX_KEY_EVENTS];
+#endif //TIMER_SCAN
+
+#ifndef NO_DEBOUNCE
+Debouncer right_debouncer;
+Debouncer left_debouncer;
+unsigned long last_debounce_tick = 0;
+#endif //NO_DEBOUNCE
 
 RightKeyboard right_keyboard;
+LeftKeyboard left_keyboard;
 Keyboard* edited_keyboard = nullptr;
+// buttons of the keys being held, released with the layout they were
+// pressed with
+HeldButtons held_buttons;
+
+#ifdef BMP
+// bellows pressure sensor, not read when begin() didn't find it
+Bellows bellows;
+bool bellows_present = false;
+Controller expression_controller(EXPRESSION_HYSTERESIS, EXPRESSION_INTERVAL_MS,
+                                 0, 16383);
+#endif
+#ifdef JOYSTICK
+int joystick_center = 512;
+Controller pitch_bend_controller(PITCH_BEND_HYSTERESIS, PITCH_BEND_INTERVAL_MS,
+                                 -8192, 8191);
+#endif
+// bandwidth shared by the controllers
+ControllerBudget controller_budget;
+
+// The Arduino IDE generates these, declare them for host builds
+bool debounce_tick();
+void scan_group(uint8_t group, bool debounce_tick);
+void scan_tick();
+void trigger_key(const KeyEvent &event);
+uint8_t expression_bytes();
+void send_expression(uint16_t expression);
+void init_joystick();
+int scan_joystick();
+void trigger_button(uint8_t key, const Button *button, bool on);
+bool held_note(uint8_t channel, uint8_t note);
+void layout_changed();
+void send_panic();
+void sendKeyboards(bool packed);
+Keyboard* keyboard_from_type(byte type);
+void send_preset(Keyboard &keyboard, uint8_t slot);
+void send_error(byte command);
+void collect_chord_shapes();
+void send_presets();
+void set_buttons(const byte* data, unsigned size);
+void send_buttons(const byte* data, unsigned size);
+void send_checksum(const byte* data, unsigned size);
+void select_register(const byte* data, unsigned size);
+void send_stats(const byte* data, unsigned size);
+void send_trace(const byte* data, unsigned size);
+void systemExclusiveHandler(byte* data, unsigned size);
+void timed_sysex_handler(byte* data, unsigned size);
 
 void setup()
 {
   //Handle incoming midi messages
+  #ifdef STATS
+  MIDI.setHandleSystemExclusive(timed_sysex_handler);
+  #else
   MIDI.setHandleSystemExclusive(systemExclusiveHandler);
+  #endif
   #ifdef DEBUG
     Serial.begin(9600);
     while (!Serial);
@@ -97,179 +171,623 @@ void setup()
   //Disable soft thru so that incoming message are not sent back
   MIDI.turnThruOff();
 
-  //Digital output pins start turned off
-  for (int i=38; i<=49; i++) {
-    pinMode(i,OUTPUT);
-    digitalWrite(i, LOW);
-  }
-
-  //Turn on pullup resistor on input pins D22-D37
-  for (int i=22; i<=37; i++) {
-    pinMode(i, INPUT);
-  }
+  //Digital output pins start turned off, input pins D22-D37 are inputs
+  hal_init_matrix();
 
-  // Init right keyboard
-  apply_default_right_keyboard();
+  // Init keyboards, after the chord shapes of the presets were read
+  presets.begin();
+  right_keyboard.applyDefault(right_keyboard_default,
+                              sizeof(right_keyboard_default));
+  left_keyboard.applyDefault(left_keyboard_default,
+                             sizeof(left_keyboard_default));
+  // Then the presets that were active when it was turned off
+  presets.restore(right_keyboard);
+  presets.restore(left_keyboard);
 
   #ifdef BMP
-    init_BMP();
+    hal_init_i2c();
+    bellows_present = bellows.begin();
   #endif
 
   #ifdef JOYSTICK
     init_joystick();
   #endif
+
+  #ifdef TIMER_SCAN
+    hal_start_scan_timer(SCAN_PERIOD_US / GROUP_COUNT);
+  #endif
 }
 
 //MIDI Control Change code for expression, which is a percentage of velocity
 const int CC_Expression = 11;
-int prev_expression = 127;
-//The BMP_180 is very sensitive, so readings can vary wildly from sample to sample.
-//We're getting around this by computing and sending the average of bmp_sample_rate samples.
-//A smaller bmp_sample_rate is more granular, but allows more "noise" to come in.
-//A larger bmp_sample_rate is less granular, but has a smoother contour.
-//Setting bmp_sample_rate too large may also lose the amount of perceived expression
-//and create a noticable delay between squeezing the bellows and hearing the volume change,
-//resulting in choppy crescendos and decrescendos.
-//Tweak this value as needed.
-const int bmp_sample_rate = 5;
-int expression_avg[bmp_sample_rate];
-int e = 0;
-
-int joystick_prev_val = 0;
 
 bool receivingSysEx = false;
 
 void loop()
 {
+  #ifdef STATS
+  unsigned long section_start = micros();
+  #endif
   #ifndef DEBUG
   MIDI.read();
+  // A long SysEx or an upload comes in faster than one byte per loop.
+  // Parse a bounded number of bytes so that it doesn't overflow the serial
+  // buffer, nor hold the keys for long.
+  for(uint8_t i=1; (receivingSysEx || layout_upload.active())
+                   && i<SYSEX_BYTES_PER_LOOP
+                   && MIDI_SERIAL.available(); i++)
+    MIDI.read();
+  midi_out.drain();
   #endif //DEBUG
-  // When receiving a long SysEx, disabling the main loop so that we don't miss
-  // parts of the SysEx
-  if(!receivingSysEx) {
-    #ifdef BMP
-      //Read pressure from the BMP_180 and convert it to MIDI expression
-      int expression = get_expression(prev_expression);
-  
-      //Ignore it if it didn't change
-      if(expression != prev_expression) {
-        expression_avg[e] = expression;
-        //Only send MIDI CC every bmp_sample_rate times,
-        //but send the average of the last bmp_sample_rate deltas
-        if (e == bmp_sample_rate - 1){
-          expression = 0;
-          for (int i=0; i<bmp_sample_rate; i++){
-            expression += expression_avg[i];
-          }
-          expression = expression/bmp_sample_rate;
-  
-          #ifdef DEBUG
-            Serial.print("Expression Change: ");
-            Serial.println(expression);
-          #else
-            MIDI.sendControlChange(CC_Expression,expression,1);
-            //Don't let bass overpower melody
-            MIDI.sendControlChange(CC_Expression,constrain(expression-6,0,127),2);
-            //Don't let chords overpower melody
-            MIDI.sendControlChange(CC_Expression,constrain(expression-12,0,127),3);
-          #endif
-          prev_expression = expression;
-          e = 0;
-        }
-        else {
-          e = e + 1;
-        }
-      }
+  #ifdef STATS
+  stats.midiRead(micros() - section_start);
+  section_start = micros();
+  #endif
+
+  #ifdef BMP
+    //Read pressure from the BMP_180 and convert it to MIDI expression
+    uint16_t expression;
+    if(bellows_present && bellows.update(expression))
+      expression_controller.set(expression);
+    if(expression_controller.ready()) {
+      const uint8_t bytes = expression_bytes();
+      if(!ControllerBudget::fits(bytes)) // It would wait forever
+        expression_controller.drop();
+      else if(controller_budget.spend(bytes))
+        send_expression(expression_controller.take());
+    }
+  #endif
+
+  #ifdef JOYSTICK
+    pitch_bend_controller.set(scan_joystick());
+    if(pitch_bend_controller.ready() && controller_budget.spend(3)) {
+      const int pitch_bend_val = pitch_bend_controller.take();
+      #ifdef DEBUG
+        Serial.print("Pitch Bend Change: ");
+        Serial.println(pitch_bend_val);
+      #else
+        //Comment and uncomment to select which channels you want pitch bend to affect.
+        midi_out.pitchBend(pitch_bend_val, 1);
+        //midi_out.pitchBend(pitch_bend_val, 2);
+        //midi_out.pitchBend(pitch_bend_val, 3);
+      #endif
+    }
+  #endif
+  #ifdef STATS
+  stats.sensorRead(micros() - section_start);
+  #endif
+
+  #ifdef TIMER_SCAN
+  // The matrix is scanned by the timer interrupt, get what it found
+  KeyEvent event;
+  while(key_event_queue.pop(event))
+    trigger_key(event);
+  #else
+  const bool tick = debounce_tick();
+  for(uint8_t group=0; group<GROUP_COUNT; group++)
+    scan_group(group, tick);
+  #ifdef STATS
+  stats.scanDone(micros());
+  #endif
+
+  // Trigger the keys that changed during this scan
+  uint8_t count;
+  do {
+    count = matrix.diff(key_events, MAX_KEY_EVENTS);
+    for(uint8_t i=0; i<count; i++)
+      trigger_key(key_events[i]);
+  } while(count == MAX_KEY_EVENTS);
+  #endif //TIMER_SCAN
+  // Start sending what this scan triggered without waiting for the UART
+  midi_out.drain();
+  #ifdef STATS
+  if(midi_out.isEmpty())
+    stats.outputEmpty();
+  #endif
+  // Remember the presets switched to once nothing sounds: writing the
+  // EEPROM blocks
+  if(midi_out.activeNotes().count() == 0)
+    presets.flush();
+}
+
+/**
+ * Return true once every DEBOUNCE_TICK_US, called before each full scan.
+ */
+bool debounce_tick() {
+  #ifndef NO_DEBOUNCE
+  const unsigned long now = micros();
+  if(now - last_debounce_tick >= DEBOUNCE_TICK_US) {
+    last_debounce_tick = now;
+    return true;
+  }
+  #endif //NO_DEBOUNCE
+  return false;
+}
+
+/**
+ * Drive a group and store the (debounced) state of its keys in the matrix.
+ */
+void scan_group(uint8_t group, bool debounce_tick) {
+  hal_group_on(group);
+  // pin value = 1 if pressed, 0 if not
+  byte right_reg_value = hal_read_right();
+  byte left_reg_value = hal_read_left();
+  hal_group_off(group);
+  #ifdef TRACE
+  trace.rawKeys(group, RIGHT_COLUMN, right_reg_value);
+  trace.rawKeys(group, LEFT_COLUMN, left_reg_value);
+  #endif
+  #ifndef NO_DEBOUNCE
+  right_reg_value = right_debouncer.update(group, right_reg_value,
+                                           debounce_tick);
+  left_reg_value = left_debouncer.update(group, left_reg_value,
+                                         debounce_tick);
+  #else
+  (void)debounce_tick;
+  #endif //NO_DEBOUNCE
+  matrix.setKeys(group, RIGHT_COLUMN, right_reg_value);
+  matrix.setKeys(group, LEFT_COLUMN, left_reg_value);
+}
+
+#ifdef TIMER_SCAN
+/**
+ * Scan one group, called by the timer interrupt every
+ * SCAN_PERIOD_US / GROUP_COUNT. After the last group, push the keys that
+ * changed to key_event_queue.
+ */
+void scan_tick() {
+  static uint8_t group = 0;
+  static bool tick = false;
+  if(group == 0)
+    tick = debounce_tick();
+  scan_group(group, tick);
+  if(++group == GROUP_COUNT) {
+    group = 0;
+    #ifdef STATS
+    stats.scanDone(micros());
     #endif
-  
-    #ifdef JOYSTICK
-      int pitch_bend_val = scan_joystick();
-      if(pitch_bend_val != joystick_prev_val) {
-        #ifdef DEBUG
-          Serial.print("Pitch Bend Change: ");
-          Serial.println(pitch_bend_val);
+    key_event_queue.pushChanges(matrix);
+  }
+}
+
+#ifdef ARDUINO
+ISR(TIMER3_COMPA_vect) {
+  scan_tick();
+}
+#endif //ARDUINO
+#endif //TIMER_SCAN
+
+/**
+ * Number of bytes send_expression() sends.
+ */
+uint8_t expression_bytes() {
+  #if defined(EXPRESSION_NRPN)
+  const uint8_t bytes = 12;
+  #elif defined(EXPRESSION_14BIT)
+  const uint8_t bytes = 6;
+  #else
+  const uint8_t bytes = 3;
+  #endif
+  uint8_t count = 0;
+  for(uint8_t i=0; i<MAX_EXPRESSION_TARGETS; i++) {
+    count += right_keyboard.expression[i].channel != 0;
+    count += left_keyboard.expression[i].channel != 0;
+  }
+  return count * bytes;
+}
+
+/**
+ * Send the 14-bit bellows expression to the channels the layouts ask for,
+ * with their offsets (in 7-bit steps).
+ */
+void send_expression(uint16_t expression) {
+  #ifdef DEBUG
+    Serial.print("Expression Change: ");
+    Serial.println(expression >> 7);
+  #else
+    Keyboard *keyboards[2] = {&right_keyboard, &left_keyboard};
+    for(uint8_t k=0; k<2; k++) {
+      for(uint8_t i=0; i<MAX_EXPRESSION_TARGETS; i++) {
+        const ExpressionTarget &target = keyboards[k]->expression[i];
+        if(!target.channel)
+          continue;
+        const uint16_t value = constrain((long)expression + target.offset * 128,
+                                         0L, 16383L);
+        #ifdef EXPRESSION_NRPN
+          midi_out.controlChange(99, EXPRESSION_NRPN_PARAMETER >> 7,
+                                 target.channel);
+          midi_out.controlChange(98, EXPRESSION_NRPN_PARAMETER & 0x7F,
+                                 target.channel);
+          midi_out.controlChange(6, value >> 7, target.channel);
+          midi_out.controlChange(38, value & 0x7F, target.channel);
         #else
-          //Comment and uncomment to select which channels you want pitch bend to affect.
-          MIDI.sendPitchBend(pitch_bend_val, 1);
-          //MIDI.sendPitchBend(pitch_bend_val, 2);
-          //MIDI.sendPitchBend(pitch_bend_val, 3);
-          joystick_prev_val = pitch_bend_val;
+          midi_out.controlChange(CC_Expression, value >> 7, target.channel);
+          #ifdef EXPRESSION_14BIT
+            midi_out.controlChange(CC_Expression + 32, value & 0x7F,
+                                   target.channel);
+          #endif
         #endif
       }
-    #endif
-    
-    for(int pin=38, group=0; pin<=49; pin++, group++){
-      //TODO - I wonder if we can replace this with direct port write for
-      // even better performance?
-      digitalWrite(pin, HIGH);
-      // pin value = 1 if pressed, 0 if not
-      byte right_reg_value = PINA;
-      byte left_reg_value = PINC;
-      digitalWrite(pin, LOW);
-      digitalWrite(pin+1 == 50 ? 38 : pin+1, HIGH);
-      scan_pins(right_keyboard, group, right_reg_value,
-                right_keys_status[group]);
     }
+  #endif
+}
+
+#ifdef JOYSTICK
+/**
+ * Take the rest position of the joystick as its center.
+ */
+void init_joystick() {
+  long sum = 0;
+  for(uint8_t i=0; i<8; i++)
+    sum += hal_read_joystick();
+  joystick_center = sum / 8;
+}
+
+/**
+ * Pitch bend of the joystick position, from -8192 to 8191.
+ */
+int scan_joystick() {
+  const long bend = (long)(hal_read_joystick() - joystick_center) * 16;
+  return constrain(bend, -8192L, 8191L);
+}
+#endif //JOYSTICK
+
+/**
+ * Trigger the button of the keyboard a key belongs to. The keyboards are
+ * used with their own type so that finding the button is inlined.
+ */
+void trigger_key(const KeyEvent &event) {
+  #ifdef STATS
+  stats.edge();
+  #endif
+  const uint8_t key = event.group * MATRIX_COLUMNS + event.index;
+  #ifdef TRACE
+  trace.add(event.on ? TRACE_KEY_PRESS : TRACE_KEY_RELEASE, key);
+  #endif
+  if(event.index < LEFT_COLUMN)
+    trigger_button(key, right_keyboard.getButton(event.group,
+                                                 event.index - RIGHT_COLUMN),
+                   event.on);
+  else
+    trigger_button(key, left_keyboard.getButton(event.group,
+                                                event.index - LEFT_COLUMN),
+                   event.on);
+}
+
+/**
+ * Play or release the button of a key, button being the one the key has
+ * in the register played.
+ */
+void trigger_button(uint8_t key, const Button *button, bool on) {
+  if (on) {
+    if(button->type == PRESET_BUTTON) {
+      Keyboard *target = keyboard_from_type(button->message[0]);
+      if(target && presets.load(*target, button->message[1]))
+        layout_changed();
+      return;
+    }
+    if(button->type == PANIC_BUTTON) {
+      midi_out.notesOff(nullptr);
+      return;
+    }
+    if(button->type == REGISTER_BUTTON) {
+      Keyboard *target = keyboard_from_type(button->message[0]);
+      const bool changed = target && (button->message[2]
+                             ? target->shiftRegister(button->message[1])
+                             : target->selectRegister(button->message[1]));
+      if(changed)
+        layout_changed();
+      held_buttons.press(key, *button);
+      return;
+    }
+    button->on();
+    held_buttons.press(key, *button);
+  }
+  else {
+    Button held;
+    if(held_buttons.release(key, held))
+      button = &held;
+    if(button->type == REGISTER_BUTTON) {
+      // Back from a shift, the notes held keep their note-off
+      Keyboard *target = keyboard_from_type(button->message[0]);
+      if(target && button->message[2]) {
+        target->releaseShift();
+        layout_changed();
+      }
+    }
+    else
+      button->off(held_note);
+  }
+}
+
+bool held_note(uint8_t channel, uint8_t note) {
+  return held_buttons.plays(channel, note);
+}
+
+/**
+ * Switch a keyboard to another register with a 0x0B SysEx: keyboard type
+ * and register. It can be followed by a register to fill it from first,
+ * a transposition + 64 and a channel (0 to keep them), see
+ * Keyboard::deriveRegister(). Reply with the keyboard type, the register
+ * played and the number of registers, or with an error.
+ */
+void select_register(const byte* data, unsigned size) {
+  // Type and register, then 0xF7
+  Keyboard *keyboard = size >= 6 ? keyboard_from_type(data[3]) : nullptr;
+  if(!keyboard || (size >= 9 && !keyboard->deriveRegister(data[4], data[5],
+                                                          data[6] - 64,
+                                                          data[7]))
+     || !keyboard->selectRegister(data[4])) {
+    send_error(0x0B);
+    return;
+  }
+  layout_changed();
+  const byte reply[] = {0xF0, 0x7D, 0x0B, data[3],
+                        keyboard->activeRegister(), KEYBOARD_REGISTERS, 0xF7};
+  midi_out.sendSysEx(sizeof(reply), reply, true);
+}
+
+/**
+ * Reply to a 0x0C SysEx with the counters of Stats::report(), followed by
+ * the MIDI output queue high-water mark, the peak polyphony, the number of
+ * note-offs of notes that weren't sounding, and the number of expression
+ * and pitch bend readings suppressed (0 without BMP or JOYSTICK), 3 bytes
+ * each. 0x01 after the command resets the counters once sent. Without
+ * STATS, the reply is empty.
+ */
+void send_stats(const byte* data, unsigned size) {
+  #ifdef STATS
+  byte reply[4 + STATS_REPORT_BYTES + 5*3] = {0xF0, 0x7D, 0x0C};
+  byte *p = reply + 3;
+  p += stats.report(p);
+  const ActiveNotes &notes = midi_out.activeNotes();
+  p = Stats::put(p, midi_out.highWaterMark(), 3);
+  p = Stats::put(p, notes.peakCount(), 3);
+  p = Stats::put(p, notes.unmatchedOffs(), 3);
+  #ifdef BMP
+  p = Stats::put(p, expression_controller.suppressedCount(), 3);
+  #else
+  p = Stats::put(p, 0, 3);
+  #endif
+  #ifdef JOYSTICK
+  p = Stats::put(p, pitch_bend_controller.suppressedCount(), 3);
+  #else
+  p = Stats::put(p, 0, 3);
+  #endif
+  *p++ = 0xF7;
+  midi_out.sendSysEx(p - reply, reply, true);
+  if(size > 4 && data[3] == 0x01) {
+    stats.reset();
+    midi_out.resetHighWaterMark();
   }
+  #else
+  (void)data;
+  (void)size;
+  const byte reply[] = {0xF0, 0x7D, 0x0C, 0xF7};
+  midi_out.sendSysEx(sizeof(reply), reply, true);
+  #endif //STATS
+}
+
+/**
+ * Reply to a 0x0D SysEx with the trace, see Trace::send(). 0x01 after the
+ * command clears it once sent. Without TRACE, the reply is empty.
+ */
+void send_trace(const byte* data, unsigned size) {
+  #ifdef TRACE
+  trace.send(size > 4 && data[3] == 0x01);
+  #else
+  (void)data;
+  (void)size;
+  const byte reply[] = {0xF0, 0x7D, 0x0D, 0xF7};
+  midi_out.sendSysEx(sizeof(reply), reply, true);
+  #endif //TRACE
+}
+
+/**
+ * Release the notes left sounding by the previous layout that no key holds
+ * anymore. The keys still held release their note themselves.
+ */
+void layout_changed() {
+  midi_out.notesOff(held_note);
+}
+
+/**
+ * Release every note sounding, held or not, and reply to the 0x0A SysEx
+ * with the number of notes released, the peak polyphony and the number of
+ * note-offs of notes that weren't sounding, each as two 7-bit bytes (low
+ * first).
+ */
+void send_panic() {
+  const uint16_t released = midi_out.notesOff(nullptr);
+  const ActiveNotes &notes = midi_out.activeNotes();
+  const byte reply[] = {0xF0, 0x7D, 0x0A,
+                        (byte)(released & 0x7F), (byte)(released >> 7),
+                        (byte)(notes.peakCount() & 0x7F),
+                        (byte)((notes.peakCount() >> 7) & 0x7F),
+                        (byte)(notes.unmatchedOffs() & 0x7F),
+                        (byte)((notes.unmatchedOffs() >> 7) & 0x7F), 0xF7};
+  midi_out.sendSysEx(sizeof(reply), reply, true);
+}
+
+/**
+ * Send the default and current layouts. With packed, the names of the
+ * current layouts are sent packed instead of base64.
+ */
+void sendKeyboards(bool packed) {
+  right_keyboard.sendDefault(right_keyboard_default,
+                             sizeof(right_keyboard_default));
+  right_keyboard.send(packed);
+  left_keyboard.sendDefault(left_keyboard_default,
+                            sizeof(left_keyboard_default));
+  left_keyboard.send(packed);
+}
+
+/**
+ * Reply to a SysEx that is cut or refers to a keyboard, group or slot that
+ * doesn't exist with the command followed by 0x7F.
+ */
+void send_error(byte command) {
+  const byte reply[] = {0xF0, 0x7D, command, 0x7F, 0xF7};
+  midi_out.sendSysEx(sizeof(reply), reply, true);
+}
+
+/**
+ * Free the chord shapes no button uses anymore, before a layout or buttons
+ * are received, so that their place can be reused.
+ */
+void collect_chord_shapes() {
+  chord_shapes.keep(presets.chordShapes() | right_keyboard.chordShapes()
+                    | left_keyboard.chordShapes()
+                    | Keyboard::editedChordShapes()
+                    | held_buttons.chordShapes());
+}
+
+Keyboard* keyboard_from_type(byte type) {
+  if(type == 0x01)
+    return &right_keyboard;
+  if(type == 0x02)
+    return &left_keyboard;
+  return nullptr;
 }
 
-void scan_pins(Keyboard &keyboard, int group, byte reg_value, int &key_status) {
-  if (reg_value != key_status){
-    //using bit-wise XOR to send modified bits only
-    check_keys(keyboard, reg_value ^ key_status, reg_value, group);
-    key_status = reg_value;
+/**
+ * Send the state of a preset slot: keyboard type, slot, flags (0x01 if the
+ * slot is used, 0x02 if it is the active one) and the base64 name.
+ */
+void send_preset(Keyboard &keyboard, uint8_t slot) {
+  unsigned char name[MAX_NAME_LENGTH];
+  byte data[6 + encode_base64_length(MAX_NAME_LENGTH - 1) + 1] =
+    {0xF0, 0x7D, 0x06};
+  data[3] = keyboard.type();
+  data[4] = slot;
+  data[5] = 0x00;
+  size_t size = 6;
+  if(presets.readName(keyboard, slot, name)) {
+    data[5] |= 0x01;
+    size += encode_base64(name, strlen((const char*)name), data + size);
   }
+  if(presets.active(keyboard) == slot)
+    data[5] |= 0x02;
+  data[size++] = 0xF7;
+  midi_out.sendSysEx(size, data, true);
 }
 
-//Check to see which bits have changed and trigger corresponding button
-void check_keys(Keyboard &keyboard, byte reg, byte PinStatus, int group){
-  for(int i=0; i<8; i++) {
-    if((reg >> i) & 1) {
-      trigger_button(keyboard, group, i, (PinStatus >> i) & 1);
+void send_presets() {
+  for(uint8_t slot=0; slot<PRESET_SLOTS; slot++)
+    send_preset(right_keyboard, slot);
+  for(uint8_t slot=0; slot<PRESET_SLOTS; slot++)
+    send_preset(left_keyboard, slot);
+}
+
+/**
+ * Set buttons from a 0x07 SysEx: keyboard type, sequence number, group and
+ * index of the first button, then the button records. The message must fit
+ * in a single chunk. Reply with the keyboard type, the sequence number,
+ * then 0x00 and the number of buttons set, or 0x01 and 0 if nothing was
+ * set.
+ */
+void set_buttons(const byte* data, unsigned size) {
+  byte reply[] = {0xF0, 0x7D, 0x07, 0x00, 0x00, 0x01, 0x00, 0xF7};
+  if(size >= 8 && data[size-1] == 0xF7) {
+    collect_chord_shapes();
+    reply[3] = data[3];
+    reply[4] = data[4];
+    Keyboard *keyboard = keyboard_from_type(data[3]);
+    if(keyboard && data[5] < GROUP_COUNT && data[6] < keyboard->columns()) {
+      const int count = keyboard->setButtons(
+        data[5]*keyboard->columns() + data[6], data+7, size-8);
+      if(count >= 0) {
+        reply[5] = 0x00;
+        reply[6] = count;
+        layout_changed();
+      }
     }
   }
+  midi_out.sendSysEx(sizeof(reply), reply, true);
 }
 
-void trigger_button(Keyboard &keyboard, int group, int pos, bool on) {
-  if (on)
-    keyboard.getButton(group, pos)->on();
-  else
-    keyboard.getButton(group, pos)->off();
+/**
+ * Reply to a 0x08 SysEx asking for count buttons (at most GET_BUTTONS_MAX)
+ * from a group and index onward with the keyboard type, group, index and
+ * the button records, or with an error.
+ */
+void send_buttons(const byte* data, unsigned size) {
+  // Type, group, index and count, then 0xF7
+  Keyboard *keyboard = size > 7 ? keyboard_from_type(data[3]) : nullptr;
+  if(!keyboard || data[4] >= GROUP_COUNT || data[5] >= keyboard->columns()) {
+    send_error(0x08);
+    return;
+  }
+  byte reply[7 + MAX_BUTTON_RECORD*GET_BUTTONS_MAX] = {0xF0, 0x7D, 0x08};
+  memcpy(reply+3, data+3, 3);
+  size_t reply_size = 6;
+  reply_size += keyboard->getButtons(data[4]*keyboard->columns() + data[5],
+                                     min(data[6], GET_BUTTONS_MAX),
+                                     reply + reply_size);
+  reply[reply_size++] = 0xF7;
+  midi_out.sendSysEx(reply_size, reply, true);
 }
 
-void apply_default_right_keyboard() {
-  byte temp[100];
-  for(size_t i=0; i<sizeof(right_keyboard_default); i+=100){
-    size_t size = min(100, sizeof(right_keyboard_default)-i);
-    memcpy_P(temp, right_keyboard_default+i, size);
-    systemExclusiveHandler(temp, size);
+/**
+ * Reply to a 0x09 SysEx with the keyboard type and the checksum of its
+ * layout, as three 7-bit bytes, or with an error.
+ */
+void send_checksum(const byte* data, unsigned size) {
+  Keyboard *keyboard = size >= 5 ? keyboard_from_type(data[3]) : nullptr;
+  if(!keyboard) {
+    send_error(0x09);
+    return;
   }
+  byte reply[] = {0xF0, 0x7D, 0x09, data[3], 0x00, 0x00, 0x00, 0xF7};
+  crc16_to_sysex(keyboard->checksum(), reply+4);
+  midi_out.sendSysEx(sizeof(reply), reply, true);
 }
 
-void send_default_right_keyboard() {
-  byte temp[100];
-  memcpy_P(temp, right_keyboard_default, 99);
-  temp[2] = 0x01; // From storage
-  MIDI.sendSysEx(99, temp, true);
-  for(size_t i=101; i<sizeof(right_keyboard_default); i+=100){
-    size_t size = min(98, sizeof(right_keyboard_default)-i);
-    memcpy_P(temp, right_keyboard_default+i, size);
-    MIDI.sendSysEx(size, temp, true);
+/**
+ * Start an upload from a 0x10 SysEx: keyboard type and layout size, see
+ * LayoutUpload. Reply with UPLOAD_READY, the window size and the largest
+ * payload, or with UPLOAD_ERROR.
+ */
+void begin_upload(const byte* data, unsigned size) {
+  byte reply[] = {0xF0, 0x7D, 0x12, UPLOAD_ERROR, 0x00, 0x00, 0xF7};
+  // The upload going on, if any, is replaced
+  layout_upload.abort();
+  collect_chord_shapes();
+  if(size >= 7 && layout_upload.begin(keyboard_from_type(data[3]),
+                                      data[4] | data[5] << 7)) {
+    reply[3] = UPLOAD_READY;
+    reply[4] = UPLOAD_WINDOW;
+    reply[5] = UPLOAD_CHUNK_BYTES;
   }
+  midi_out.sendSysEx(sizeof(reply), reply, true);
 }
 
-void sendKeyboards() {
-  send_default_right_keyboard();
-  right_keyboard.send();
+/**
+ * Take a 0x11 SysEx chunk of the upload going on and reply with its status
+ * and sequence number, see LayoutUpload.
+ */
+void upload_chunk(const byte* data, unsigned size) {
+  uint8_t seq;
+  const uint8_t status = layout_upload.chunk(data, size, seq);
+  if(status == UPLOAD_NONE)
+    return;
+  if(status == UPLOAD_DONE)
+    layout_changed();
+  const byte reply[] = {0xF0, 0x7D, 0x12, status, seq, 0xF7};
+  midi_out.sendSysEx(sizeof(reply), reply, true);
 }
 
 void systemExclusiveHandler(byte* data, unsigned size) {
+  #ifdef TRACE
+  trace.add(TRACE_SYSEX, data[0], min(size, 255U));
+  #endif
   /* If SysEx message is larger than the allocated buffer size,
      data is splitted like:
      first:  0xF0 .... 0xF0
      middle: 0xF7 .... 0xF0
      last:   0xF7 .... 0xF7
   */
+  const bool end = data[size-1] == 0xF7;
   if(data[0] == 0xF0){ // Start of a new SysEx message
     if(edited_keyboard)
       edited_keyboard->clearEdition();
@@ -277,32 +795,102 @@ void systemExclusiveHandler(byte* data, unsigned size) {
     if(data[1] == 0x7D) {// The message is for us
       if(data[2] == 0x0F) {// We will receive a long SysEx
         receivingSysEx = true;
-        MIDI.sendSysEx(sizeof(sysExDialog), sysExDialog, false);
+        midi_out.sendSysEx(sizeof(sysExDialog), sysExDialog, false);
         return;
       }
       else if(data[2] == 0x00) { // Remote asks for keyboards
-        sendKeyboards();
+        // 0x01 after the command asks for packed names
+        sendKeyboards(size > 4 && data[3] == 0x01);
+      }
+      else if(data[2] == 0x03) { // Remote asks for a full status byte
+        midi_out.resetRunningStatus();
+      }
+      else if(data[2] == 0x04 || data[2] == 0x05) { // Save or load a preset
+        Keyboard *keyboard = size >= 6 ? keyboard_from_type(data[3])
+                                       : nullptr;
+        if(keyboard && data[4] < PRESET_SLOTS) {
+          if(data[2] == 0x04)
+            presets.save(*keyboard, data[4]);
+          else if(presets.load(*keyboard, data[4]))
+            layout_changed();
+          send_preset(*keyboard, data[4]);
+        }
+        else
+          send_error(data[2]);
+      }
+      else if(data[2] == 0x06) { // Remote asks for the presets
+        send_presets();
+      }
+      else if(data[2] == 0x07) { // Remote sets some buttons
+        set_buttons(data, size);
+      }
+      else if(data[2] == 0x08) { // Remote asks for some buttons
+        send_buttons(data, size);
+      }
+      else if(data[2] == 0x09) { // Remote asks for a layout checksum
+        send_checksum(data, size);
+      }
+      else if(data[2] == 0x0A) { // Remote asks to release all the notes
+        send_panic();
+      }
+      else if(data[2] == 0x0B) { // Remote switches registers
+        select_register(data, size);
+      }
+      else if(data[2] == 0x0C) { // Remote asks for the counters
+        send_stats(data, size);
+      }
+      else if(data[2] == 0x0D) { // Remote asks for the trace
+        send_trace(data, size);
+      }
+      else if(data[2] == 0x10) { // Remote starts a layout upload
+        begin_upload(data, size);
+      }
+      else if(data[2] == 0x11) { // Remote sent a chunk of the upload
+        upload_chunk(data, size);
       }
       else if(data[2] == 0x02) { // Remote sent a keyboard to apply
+        // It replaces the upload going on, if any
+        layout_upload.abort();
         if(data[3] == 0x01) { // RightKeyboard
           edited_keyboard = &right_keyboard;
-          edited_keyboard->beginNameEdition();
+        }
+        else if(data[3] == 0x02) { // LeftKeyboard
+          edited_keyboard = &left_keyboard;
+        }
+        if(edited_keyboard) {
+          collect_chord_shapes();
+          edited_keyboard->beginEdition();
           data += 4;
           size -= 4;
         }
       }
     }
   }
-  else if(data[0] == 0xF7) { // Continuation of the previous SysEx
-    data += 1;
-    size -= 1;
-  }
 
-  if(data[size-1] == 0xF7) { // End of SysEx
+  if(end) { // End of SysEx
     receivingSysEx = false;
   }
 
   if(edited_keyboard != nullptr) {
-    edited_keyboard->editFromSysEx(data, size-1);
+    // The decoder skips the chunk boundaries
+    edited_keyboard->editFromSysEx(data, size);
+    if(end) { // The whole layout was received, play it
+      if(edited_keyboard->commitEdition())
+        layout_changed();
+      else // Dropped, or its chord shapes didn't fit
+        send_error(0x02);
+      edited_keyboard = nullptr;
+    }
   }
 }
+
+#ifdef STATS
+/**
+ * systemExclusiveHandler(), timed.
+ */
+void timed_sysex_handler(byte* data, unsigned size) {
+  const unsigned long start = micros();
+  systemExclusiveHandler(data, size);
+  stats.sysExHandled(micros() - start);
+}
+#endif //STATS
@@ -0,0 +1,107 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __BELLOWS_H__
+#define __BELLOWS_H__
+
+#include "hal.h"
+
+#define BMP180_ADDRESS 0x77
+// Oversampling setting, 0 to 3: conversions take 4.5, 7.5, 13.5 or 25.5 ms
+#ifndef BMP180_OSS
+#define BMP180_OSS 1
+#endif
+// A temperature is read every this many pressures, it changes slowly.
+#define BMP180_TEMPERATURE_EVERY 32
+
+// Time constant of the pressure low-pass filter.
+#ifndef BELLOWS_TAU_MS
+#define BELLOWS_TAU_MS 20
+#endif
+// Pressure difference with the ambient pressure giving the full expression.
+#ifndef BELLOWS_FULL_SCALE_PA
+#define BELLOWS_FULL_SCALE_PA 1000
+#endif
+// Number of samples averaged at start to get the ambient pressure.
+#define BELLOWS_AMBIENT_SAMPLES 16
+
+/**
+ * BMP180 pressure sensor, read without waiting for its conversions.
+ *
+ * update() is called on every loop: it starts a conversion and returns at
+ * once, and collects the result on the first call after the conversion time
+ * is over. The pressure is compensated as described in the datasheet.
+ */
+class Bmp180
+{
+  public:
+    Bmp180() : state(BMP_OFF), pressure_count(0)
+    {};
+    bool begin();
+    bool update();
+    // Last pressure read, in Pa
+    int32_t pressure() const { return p; }
+  private:
+    enum State : uint8_t
+    {
+      BMP_OFF,         // Not found or not calibrated yet, see begin()
+      BMP_IDLE,        // No conversion started
+      BMP_TEMPERATURE, // Converting the temperature
+      BMP_PRESSURE     // Converting the pressure
+    };
+    void start(State conversion);
+    int32_t compensate(int32_t up) const;
+
+    // Calibration coefficients
+    int16_t ac1, ac2, ac3;
+    uint16_t ac4, ac5, ac6;
+    int16_t b1, b2, mb, mc, md;
+    // Temperature term of the pressure compensation
+    int32_t b5;
+    int32_t p;
+    unsigned long start_time;
+    uint8_t state;
+    uint8_t pressure_count;
+};
+
+/**
+ * Turns the bellows pressure into a 14-bit expression, from 0 to 16383.
+ *
+ * The expression is the difference between the pressure and the ambient
+ * pressure measured at start, in both directions (push and pull), through a
+ * fixed-point one-pole low-pass filter of time constant BELLOWS_TAU_MS.
+ */
+class Bellows
+{
+  public:
+    Bellows() : ambient(0), ambient_count(0)
+    {};
+    bool begin() { return sensor.begin(); }
+    bool update(uint16_t &expression);
+  private:
+    Bmp180 sensor;
+    // Pressures in 1/16 Pa
+    int32_t ambient;
+    int32_t filtered;
+    unsigned long last_sample;
+    uint8_t ambient_count;
+};
+
+#endif //__BELLOWS_H__
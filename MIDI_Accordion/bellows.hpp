@@ -0,0 +1,162 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "bellows.h"
+
+// Conversion time of each oversampling setting
+static const unsigned int bmp180_pressure_us[4] = {4500, 7500, 13500, 25500};
+#define BMP180_TEMPERATURE_US 4500
+
+/**
+ * Check that the sensor is there and read its calibration. Blocks for the
+ * I2C transfer, call it from setup(). Until it succeeds, update() does
+ * nothing: the compensation divides by calibration coefficients.
+ */
+bool Bmp180::begin()
+{
+  uint8_t id;
+  if(!hal_i2c_read(BMP180_ADDRESS, 0xD0, &id, 1) || id != 0x55)
+    return false;
+  uint8_t data[22];
+  if(!hal_i2c_read(BMP180_ADDRESS, 0xAA, data, sizeof(data)))
+    return false;
+  int16_t *coefficients[11] = {&ac1, &ac2, &ac3, (int16_t *)&ac4,
+                               (int16_t *)&ac5, (int16_t *)&ac6, &b1, &b2,
+                               &mb, &mc, &md};
+  for(uint8_t i=0; i<11; i++)
+    *coefficients[i] = (int16_t)((data[2*i] << 8) | data[2*i + 1]);
+  state = BMP_IDLE;
+  return true;
+}
+
+void Bmp180::start(State conversion)
+{
+  const uint8_t command = conversion == BMP_TEMPERATURE
+                          ? 0x2E : 0x34 | (BMP180_OSS << 6);
+  state = hal_i2c_write(BMP180_ADDRESS, 0xF4, command) ? conversion : BMP_IDLE;
+  start_time = micros();
+}
+
+/**
+ * Start or collect a conversion, never waiting for one. Return true when a
+ * new pressure was read.
+ */
+bool Bmp180::update()
+{
+  uint8_t data[3];
+  switch(state)
+  {
+  case BMP_OFF:
+    return false;
+  case BMP_IDLE:
+    start(BMP_TEMPERATURE);
+    return false;
+  case BMP_TEMPERATURE: {
+    if(micros() - start_time < BMP180_TEMPERATURE_US)
+      return false;
+    if(!hal_i2c_read(BMP180_ADDRESS, 0xF6, data, 2)) {
+      state = BMP_IDLE;
+      return false;
+    }
+    const int32_t ut = (data[0] << 8) | data[1];
+    const int32_t x1 = ((ut - ac6) * ac5) >> 15;
+    const int32_t x2 = ((int32_t)mc * 2048) / (x1 + md);
+    b5 = x1 + x2;
+    start(BMP_PRESSURE);
+    return false;
+  }
+  case BMP_PRESSURE: {
+    if(micros() - start_time < bmp180_pressure_us[BMP180_OSS])
+      return false;
+    if(!hal_i2c_read(BMP180_ADDRESS, 0xF6, data, 3)) {
+      state = BMP_IDLE;
+      return false;
+    }
+    const int32_t up = (((int32_t)data[0] << 16) | ((int32_t)data[1] << 8)
+                        | data[2]) >> (8 - BMP180_OSS);
+    p = compensate(up);
+    if(++pressure_count == BMP180_TEMPERATURE_EVERY) {
+      pressure_count = 0;
+      start(BMP_TEMPERATURE);
+    }
+    else {
+      start(BMP_PRESSURE);
+    }
+    return true;
+  }
+  }
+  return false;
+}
+
+/**
+ * True pressure in Pa from the raw pressure, with the datasheet algorithm.
+ */
+int32_t Bmp180::compensate(int32_t up) const
+{
+  const int32_t b6 = b5 - 4000;
+  int32_t x1 = ((int32_t)b2 * ((b6 * b6) >> 12)) >> 11;
+  int32_t x2 = ((int32_t)ac2 * b6) >> 11;
+  int32_t x3 = x1 + x2;
+  const int32_t b3 = ((((int32_t)ac1 * 4 + x3) << BMP180_OSS) + 2) / 4;
+  x1 = ((int32_t)ac3 * b6) >> 13;
+  x2 = ((int32_t)b1 * ((b6 * b6) >> 12)) >> 16;
+  x3 = ((x1 + x2) + 2) >> 2;
+  const uint32_t b4 = ((uint32_t)ac4 * (uint32_t)(x3 + 32768)) >> 15;
+  const uint32_t b7 = ((uint32_t)up - b3) * (50000 >> BMP180_OSS);
+  int32_t pressure = b7 < 0x80000000 ? (b7 * 2) / b4 : (b7 / b4) * 2;
+  x1 = (pressure >> 8) * (pressure >> 8);
+  x1 = (x1 * 3038) >> 16;
+  x2 = (-7357 * pressure) >> 16;
+  return pressure + ((x1 + x2 + 3791) >> 4);
+}
+
+/**
+ * Run the sensor and the filter. Return true, with the expression, when a
+ * new pressure was read.
+ */
+bool Bellows::update(uint16_t &expression)
+{
+  if(!sensor.update())
+    return false;
+  const int32_t pressure = sensor.pressure() * 16;
+  const unsigned long now = micros();
+  if(ambient_count < BELLOWS_AMBIENT_SAMPLES) { // Still measuring ambient
+    ambient += pressure / BELLOWS_AMBIENT_SAMPLES;
+    ambient_count++;
+    filtered = pressure;
+    last_sample = now;
+    return false;
+  }
+
+  // filtered += (pressure - filtered) * dt / (tau + dt), in 1/256
+  const unsigned long dt = now - last_sample;
+  last_sample = now;
+  int32_t alpha = (dt * 256) / (BELLOWS_TAU_MS * 1000UL + dt);
+  if(alpha < 1)
+    alpha = 1;
+  filtered += ((pressure - filtered) * alpha) >> 8;
+
+  int32_t difference = (filtered - ambient) / 16;
+  if(difference < 0)
+    difference = -difference;
+  difference = min(difference, (int32_t)BELLOWS_FULL_SCALE_PA);
+  expression = difference * 16383 / BELLOWS_FULL_SCALE_PA;
+  return true;
+}
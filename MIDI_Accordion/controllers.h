@@ -0,0 +1,95 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __CONTROLLERS_H__
+#define __CONTROLLERS_H__
+
+#include "hal.h"
+#include "midi_out.h"
+
+// Bandwidth the continuous controllers may use together, in bytes per
+// second (115200 baud is 11520), and how much of it can be saved up. The
+// burst must hold the largest message: the NRPN expression to every target
+// of both keyboards, 2 * MAX_EXPRESSION_TARGETS * 12 bytes. A larger one
+// is dropped.
+#ifndef CONTROLLER_BYTES_PER_SECOND
+#define CONTROLLER_BYTES_PER_SECOND 1500
+#endif
+#ifndef CONTROLLER_BURST_BYTES
+#define CONTROLLER_BURST_BYTES 96
+#endif
+
+/**
+ * A continuous controller (expression, pitch bend) between its sensor and
+ * the MIDI output.
+ *
+ * A new value is only sent if it is more than hysteresis away from the
+ * last value sent, or if it reached low or high, and no sooner than
+ * min_interval_ms after it. A value that has to wait is kept and replaced by
+ * newer ones, so the last value always goes out. Readings that change but
+ * are never sent are counted as suppressed.
+ */
+class Controller
+{
+  public:
+    Controller(uint16_t hysteresis, uint8_t min_interval_ms, int16_t low,
+               int16_t high)
+      : hysteresis(hysteresis), min_interval_ms(min_interval_ms), low(low),
+        high(high), reading(low), sent(low - 1), sent_time(0), pending(false),
+        suppressed(0)
+    {};
+    void set(int16_t value);
+    bool ready() const;
+    int16_t take();
+    void drop();
+    uint16_t suppressedCount() const { return suppressed; }
+  private:
+    const uint16_t hysteresis;
+    const uint8_t min_interval_ms;
+    const int16_t low;
+    const int16_t high;
+    // Last reading, and last value sent (out of range until the first one)
+    int16_t reading;
+    int16_t sent;
+    unsigned long sent_time;
+    // reading is waiting to be sent
+    bool pending;
+    uint16_t suppressed;
+};
+
+/**
+ * Token bucket shared by the controllers, so that together they never use
+ * more than CONTROLLER_BYTES_PER_SECOND. They are also held back while any
+ * note is waiting in the MIDI output queues, so they never delay a note.
+ */
+class ControllerBudget
+{
+  public:
+    ControllerBudget() : tokens(CONTROLLER_BURST_BYTES), last_refill(0)
+    {};
+    bool spend(uint8_t bytes);
+    // A message of bytes can ever be sent
+    static bool fits(uint8_t bytes) { return bytes <= CONTROLLER_BURST_BYTES; }
+  private:
+    uint8_t tokens;
+    unsigned long last_refill;
+};
+
+#endif //__CONTROLLERS_H__
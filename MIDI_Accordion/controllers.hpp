@@ -0,0 +1,91 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "controllers.h"
+
+/**
+ * Give the controller a new reading.
+ */
+void Controller::set(int16_t value)
+{
+  if(value == reading)
+    return;
+  reading = value;
+  const uint16_t change = value > sent ? value - sent : sent - value;
+  if(change <= hysteresis
+     && !(value != sent && (value == low || value == high))) {
+    // Back close to what was sent, forget what was waiting
+    if(pending)
+      suppressed++;
+    pending = false;
+    suppressed++;
+    return;
+  }
+  if(pending) // The value waiting is replaced
+    suppressed++;
+  pending = true;
+}
+
+/**
+ * Return true if the controller has a value to send and may send it now.
+ */
+bool Controller::ready() const
+{
+  return pending && millis() - sent_time >= min_interval_ms;
+}
+
+/**
+ * Take the value to send.
+ */
+int16_t Controller::take()
+{
+  pending = false;
+  sent = reading;
+  sent_time = millis();
+  return sent;
+}
+
+/**
+ * Drop the value to send, which is counted as suppressed.
+ */
+void Controller::drop()
+{
+  pending = false;
+  suppressed++;
+}
+
+/**
+ * Take bytes from the budget. Return false, taking nothing, if there is not
+ * enough left or if notes are waiting to be sent.
+ */
+bool ControllerBudget::spend(uint8_t bytes)
+{
+  const unsigned long now = micros();
+  const unsigned long earned = (now - last_refill)
+                               / (1000000UL / CONTROLLER_BYTES_PER_SECOND);
+  if(earned) {
+    tokens = min(tokens + earned, (unsigned long)CONTROLLER_BURST_BYTES);
+    last_refill += earned * (1000000UL / CONTROLLER_BYTES_PER_SECOND);
+  }
+  if(tokens < bytes || !midi_out.isEmpty())
+    return false;
+  tokens -= bytes;
+  return true;
+}
@@ -0,0 +1,51 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __CRC_H__
+#define __CRC_H__
+
+#include "hal.h"
+
+#define CRC16_INIT 0xFFFF
+
+/**
+ * Add a byte to a CRC-16/CCITT-FALSE (polynomial 0x1021, initial value
+ * CRC16_INIT, no reflection), the CRC the editor computes to check what it
+ * sent or received.
+ */
+inline uint16_t crc16_update(uint16_t crc, byte data)
+{
+  crc ^= (uint16_t)data << 8;
+  for(uint8_t i=0; i<8; i++)
+    crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  return crc;
+}
+
+/**
+ * Split a CRC in 7-bit bytes for a SysEx, most significant first.
+ */
+inline void crc16_to_sysex(uint16_t crc, byte *data)
+{
+  data[0] = crc >> 14;
+  data[1] = (crc >> 7) & 0x7F;
+  data[2] = crc & 0x7F;
+}
+
+#endif //__CRC_H__
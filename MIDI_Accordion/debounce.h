@@ -0,0 +1,62 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __DEBOUNCE_H__
+#define __DEBOUNCE_H__
+
+#include "hal.h"
+
+/*
+ * A key changes state once its new level has been read continuously for
+ * a number of debounce ticks. With DEBOUNCE_PRESS_TICKS set to 1, a press is
+ * reported on the very scan that sees it (no added latency) and only the
+ * release is filtered: fast-press, slow-release mode. Setting both to the
+ * same value filters both edges the same way.
+ * Values go from 1 to 8.
+ */
+#ifndef DEBOUNCE_TICK_US
+#define DEBOUNCE_TICK_US 1000
+#endif
+#ifndef DEBOUNCE_PRESS_TICKS
+#define DEBOUNCE_PRESS_TICKS 1
+#endif
+#ifndef DEBOUNCE_RELEASE_TICKS
+#define DEBOUNCE_RELEASE_TICKS 5
+#endif
+
+/**
+ * Debounces the keys of one keyboard, a group (8 keys) at a time.
+ *
+ * Each key has a 3-bit counter of the ticks its raw level has differed from
+ * its debounced state. The counters are stored as vertical counters: bit n of
+ * the counters of a group's 8 keys are packed in count[n], so that the whole
+ * group is updated with a handful of bitwise operations.
+ */
+class Debouncer
+{
+  public:
+    Debouncer();
+    byte update(uint8_t group, byte raw, bool tick);
+  private:
+    byte state[GROUP_COUNT];
+    byte count[3][GROUP_COUNT];
+};
+
+#endif //__DEBOUNCE_H__
@@ -0,0 +1,68 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "debounce.h"
+
+/**
+ * Mask of the keys whose counter (c2 c1 c0) equals value.
+ */
+static inline byte counter_equals(byte c0, byte c1, byte c2, uint8_t value)
+{
+  return (value & 4 ? c2 : ~c2) & (value & 2 ? c1 : ~c1)
+         & (value & 1 ? c0 : ~c0);
+}
+
+Debouncer::Debouncer()
+{
+  memset(state, 0, sizeof(state));
+  memset(count, 0, sizeof(count));
+}
+
+/**
+ * Feed the raw reading of a group and return its debounced state.
+ * tick is true once every DEBOUNCE_TICK_US, the counters only advance then.
+ */
+byte Debouncer::update(uint8_t group, byte raw, bool tick)
+{
+  // Keys whose raw level differs from their state, the others restart
+  const byte delta = raw ^ state[group];
+  byte c0 = count[0][group] & delta;
+  byte c1 = count[1][group] & delta;
+  byte c2 = count[2][group] & delta;
+
+  // Keys that held their new level long enough change state
+  const byte toggle = delta
+    & ((raw & counter_equals(c0, c1, c2, DEBOUNCE_PRESS_TICKS - 1))
+       | (~raw & counter_equals(c0, c1, c2, DEBOUNCE_RELEASE_TICKS - 1)));
+  state[group] ^= toggle;
+
+  // Increment the counters of the keys still waiting
+  if(tick) {
+    const byte inc = delta & ~toggle;
+    c2 ^= c1 & c0 & inc;
+    c1 ^= c0 & inc;
+    c0 ^= inc;
+  }
+  count[0][group] = c0 & ~toggle;
+  count[1][group] = c1 & ~toggle;
+  count[2][group] = c2 & ~toggle;
+
+  return state[group];
+}
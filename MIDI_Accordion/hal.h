@@ -0,0 +1,245 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __HAL_H__
+#define __HAL_H__
+
+/*
+ * Hardware abstraction layer.
+ *
+ * The scan path only talks to the board through the functions below.
+ * When building for the Arduino they map to the real pins and ports. When
+ * building on a host (ARDUINO not defined), sim.h provides mock ports and a
+ * mock MIDI sink so that the scan, SysEx and layout code can be run and timed
+ * on a PC.
+ */
+
+#ifdef ARDUINO
+  #include <Arduino.h>
+  #include <avr/eeprom.h>
+  #ifdef BMP
+    #include <Wire.h>
+  #endif
+#else
+  #include "sim.h"
+#endif
+
+// Output pins driving the 12 groups of the matrix.
+#define FIRST_GROUP_PIN 38
+#define LAST_GROUP_PIN 49
+#define GROUP_COUNT (LAST_GROUP_PIN - FIRST_GROUP_PIN + 1)
+// Input pins reading the keyboards (PINA and PINC).
+#define FIRST_INPUT_PIN 22
+#define LAST_INPUT_PIN 37
+// Time given to the input lines to settle after driving a group.
+#define MATRIX_SETTLE_US 1
+// Analog input of the pitch bend joystick.
+#define JOYSTICK_PIN A0
+
+#ifndef DIGITALWRITE_MATRIX
+/*
+ * Port register and bit of each group pin, so that a group can be driven with
+ * a single read-modify-write instead of a digitalWrite (which looks up these
+ * tables in flash, checks for PWM and disables interrupts on every call).
+ * On the Mega, D38 is PD7, D39-D41 are PG2-PG0 and D42-D49 are PL7-PL0.
+ */
+volatile uint8_t * const group_ports[GROUP_COUNT] = {
+  &PORTD,
+  &PORTG, &PORTG, &PORTG,
+  &PORTL, &PORTL, &PORTL, &PORTL, &PORTL, &PORTL, &PORTL, &PORTL
+};
+const uint8_t group_masks[GROUP_COUNT] = {
+  1 << 7,
+  1 << 2, 1 << 1, 1 << 0,
+  1 << 7, 1 << 6, 1 << 5, 1 << 4, 1 << 3, 1 << 2, 1 << 1, 1 << 0
+};
+#endif //DIGITALWRITE_MATRIX
+
+/**
+ * Configure the matrix pins: outputs start turned off, inputs are floating.
+ */
+inline void hal_init_matrix()
+{
+  for (int i=FIRST_GROUP_PIN; i<=LAST_GROUP_PIN; i++) {
+    pinMode(i, OUTPUT);
+    digitalWrite(i, LOW);
+  }
+  for (int i=FIRST_INPUT_PIN; i<=LAST_INPUT_PIN; i++) {
+    pinMode(i, INPUT);
+  }
+}
+
+/**
+ * Drive a group, then wait for the inputs to settle.
+ */
+inline void hal_group_on(uint8_t group)
+{
+  #ifdef DIGITALWRITE_MATRIX
+  digitalWrite(FIRST_GROUP_PIN + group, HIGH);
+  #else
+  *group_ports[group] |= group_masks[group];
+  #endif //DIGITALWRITE_MATRIX
+  delayMicroseconds(MATRIX_SETTLE_US);
+}
+
+/**
+ * Stop driving a group.
+ */
+inline void hal_group_off(uint8_t group)
+{
+  #ifdef DIGITALWRITE_MATRIX
+  digitalWrite(FIRST_GROUP_PIN + group, LOW);
+  #else
+  *group_ports[group] &= ~group_masks[group];
+  #endif //DIGITALWRITE_MATRIX
+}
+
+/**
+ * Start Timer3 to call TIMER3_COMPA_vect every period_us (at most 32 ms).
+ * On the host, the simulation driver calls scan_tick() itself.
+ */
+inline void hal_start_scan_timer(unsigned int period_us)
+{
+  #ifdef ARDUINO
+  noInterrupts();
+  TCCR3A = 0;
+  // CTC mode, clk/8
+  TCCR3B = _BV(WGM32) | _BV(CS31);
+  TCNT3 = 0;
+  OCR3A = period_us * (F_CPU / 8 / 1000000) - 1;
+  TIMSK3 = _BV(OCIE3A);
+  interrupts();
+  #else
+  (void)period_us;
+  #endif //ARDUINO
+}
+
+/**
+ * Disable interrupts and return the state to give hal_restore_interrupts(),
+ * so that it can be used from an interrupt as well.
+ */
+inline uint8_t hal_disable_interrupts()
+{
+  #ifdef ARDUINO
+  const uint8_t sreg = SREG;
+  cli();
+  return sreg;
+  #else
+  return 0;
+  #endif //ARDUINO
+}
+
+inline void hal_restore_interrupts(uint8_t state)
+{
+  #ifdef ARDUINO
+  SREG = state;
+  #else
+  (void)state;
+  #endif //ARDUINO
+}
+
+// Size of the EEPROM, 4 KB on the Mega.
+#define EEPROM_SIZE (E2END + 1)
+
+/**
+ * Read size bytes of EEPROM from address.
+ */
+inline void hal_eeprom_read(unsigned int address, void *data, size_t size)
+{
+  eeprom_read_block(data, (const void *)(size_t)address, size);
+}
+
+/**
+ * Write size bytes of EEPROM at address. Only the bytes that changed are
+ * written, each taking 3.3 ms: this blocks, don't call it while playing.
+ */
+inline void hal_eeprom_write(unsigned int address, const void *data,
+                             size_t size)
+{
+  eeprom_update_block(data, (void *)(size_t)address, size);
+}
+
+#ifdef BMP
+/**
+ * Start the I2C bus the pressure sensor is on, at 400 kHz.
+ */
+inline void hal_init_i2c()
+{
+  Wire.begin();
+  Wire.setClock(400000);
+}
+
+/**
+ * Write a register of an I2C device. Return false if it didn't answer.
+ */
+inline bool hal_i2c_write(uint8_t address, uint8_t reg, uint8_t value)
+{
+  Wire.beginTransmission(address);
+  Wire.write(reg);
+  Wire.write(value);
+  return Wire.endTransmission() == 0;
+}
+
+/**
+ * Read size registers of an I2C device from reg onward. Return false if it
+ * didn't answer.
+ */
+inline bool hal_i2c_read(uint8_t address, uint8_t reg, uint8_t *data,
+                         uint8_t size)
+{
+  Wire.beginTransmission(address);
+  Wire.write(reg);
+  if(Wire.endTransmission(false) != 0)
+    return false;
+  if(Wire.requestFrom(address, size) != size)
+    return false;
+  for(uint8_t i=0; i<size; i++)
+    data[i] = Wire.read();
+  return true;
+}
+#endif //BMP
+
+/**
+ * Read the position of the joystick, from 0 to 1023.
+ */
+inline int hal_read_joystick()
+{
+  return analogRead(JOYSTICK_PIN);
+}
+
+/**
+ * Read the right keyboard inputs for the currently driven group.
+ * A bit is 1 if the key is pressed.
+ */
+inline byte hal_read_right()
+{
+  return PINA;
+}
+
+/**
+ * Read the left keyboard inputs for the currently driven group.
+ * A bit is 1 if the key is pressed.
+ */
+inline byte hal_read_left()
+{
+  return PINC;
+}
+
+#endif //__HAL_H__
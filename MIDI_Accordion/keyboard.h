@@ -21,179 +21,363 @@
 #ifndef __KEYBOARD_H__
 #define __KEYBOARD_H__
 
-#include <Arduino.h>
+#include "hal.h"
 #include "midi.h"
+#include "midi_out.h"
+#include "crc.h"
+#include "matrix.h"
 
 /**
-   Abstract class to represents a Button.
+   Types of button. The value is also the first byte of the button's
+   record in a SysEx layout.
 */
-class Button
+enum ButtonType : uint8_t
 {
-  public:
-    virtual ~Button() {};
-    virtual void on() = 0;
-    virtual void off() = 0;
-    virtual uint8_t toBytes(byte *buf) = 0;
+  NULL_BUTTON = 0x00,    // Does nothing
+  NOTE_BUTTON = 0x01,    // Sends a note on/off message
+  PROGRAM_BUTTON = 0x02, // Sends a program change message
+  CONTROL_BUTTON = 0x03, // Sends a control change message
+  PRESET_BUTTON = 0x04,  // Switches a keyboard to a preset (see presets.h)
+  PANIC_BUTTON = 0x05,   // Releases every note still sounding
+  REGISTER_BUTTON = 0x06, // Switches a keyboard to another register
+  CHORD_BUTTON = 0x07    // Sends up to MAX_CHORD_NOTES notes on/off
 };
 
 /**
-   Represents a button that does nothing.
-*/
-class NullButton: public Button
-{
-  public:
-    virtual void on()
-    {};
-    virtual void off()
-    {};
-    virtual uint8_t toBytes(byte *buf);
-};
+   Represents a button: a type and the MIDI message it sends when pressed,
+   already in wire format (status byte then data bytes), so that a key event
+   only copies bytes to the MIDI output queue:
+     NOTE_BUTTON:    0x9n, pitch, velocity (0x8n, pitch, velocity on release)
+     PROGRAM_BUTTON: 0xCn, program
+     CONTROL_BUTTON: 0xBn, control, value
+   Buttons acting on the device itself keep their parameters instead:
+     PRESET_BUTTON:  keyboard type, slot
+     PANIC_BUTTON:   nothing
+     REGISTER_BUTTON: keyboard type, register, 0x01 if only while held
+   A CHORD_BUTTON keeps 0x9n, root, then the index of its shape in
+   chord_shapes: the intervals of its other notes and their velocity.
+   The message is compiled from the SysEx record of the button when the
+   layout is applied, and decompiled when the layout is sent.
 
-/**
-   Represents a button that send a note on/off message.
+   Buttons are plain data, so a keyboard is a flat array of them and a key
+   event is a switch on the type rather than a virtual call.
 */
-class NoteButton: public Button
+struct Button
 {
-  public:
-    NoteButton(const uint8_t channel, const uint8_t pitch, const uint8_t velocity)
-      : channel(channel), pitch(pitch), velocity(velocity)
-    {};
-    virtual void on();
-    virtual void off();
-    virtual uint8_t toBytes(byte *buf);
-    static bool isValid(const uint8_t channel, const uint8_t pitch,
-                        const uint8_t velocity);
-    static void create(Button *place, const uint8_t channel,
-                       const uint8_t pitch, const uint8_t velocity);
-  private:
-    uint8_t channel;
-    uint8_t pitch;
-    uint8_t velocity;
+  uint8_t type;
+  uint8_t message[3];
+
+  void on() const;
+  void off(bool (*keep)(uint8_t channel, uint8_t note) = nullptr) const;
+  uint8_t notes(byte *notes) const;
+  uint8_t toBytes(byte *buf) const;
+  static uint8_t length(const uint8_t type);
+  static Button fromBytes(const byte *buf);
 };
 
+// Length of the longest button record, a CHORD_BUTTON's:
+//   0x07, channel, root, velocity, then 3 intervals above the root (0 if
+//   unused)
+#define MAX_BUTTON_RECORD 7
+#define MAX_CHORD_NOTES 4
+// Number of different chord shapes all the layouts can use together.
+#define CHORD_SHAPES 16
+
 /**
-   Represents a button that send a program change message.
-*/
-class ProgramButton: public Button
+ * The notes of a chord above its root, in semitones (0 if unused), and
+ * their velocity.
+ */
+struct ChordShape
 {
-  public:
-    ProgramButton(const uint8_t channel, const uint8_t program)
-      : channel(channel), program(program)
-    {};
-    virtual void on();
-    virtual void off();
-    virtual uint8_t toBytes(byte *buf);
-    static bool isValid(const uint8_t channel, const uint8_t program);
-    static void create(Button *place, const uint8_t channel,
-                       const uint8_t program);
-  private:
-    uint8_t channel;
-    uint8_t program;
+  uint8_t intervals[MAX_CHORD_NOTES - 1];
+  uint8_t velocity;
 };
 
 /**
-   Represents a button that send a control change message
-*/
-class ControlButton: public Button
+ * Pool of the chord shapes used by the chord buttons of both keyboards, so
+ * that a chord button still fits in a Button: a Stradella bass has 4 shapes
+ * (major, minor, seventh, diminished) shared by dozens of buttons.
+ *
+ * A shape is added the first time a layout uses it. The shapes no button
+ * uses anymore (not in a register, a preset, a layout being received nor a
+ * key held) are freed by keep() and their place is reused, so that the
+ * buttons saved in presets keep pointing to the right one. The pool is
+ * saved with the presets.
+ */
+class ChordShapes
 {
   public:
-    ControlButton(const uint8_t channel, const uint8_t control, const uint8_t value)
-      : channel(channel), control(control), value(value)
+    ChordShapes() : count(0), used(0), failures(0)
     {};
-    virtual void on();
-    virtual void off();
-    virtual uint8_t toBytes(byte *buf);
-    static bool isValid(const uint8_t channel, const uint8_t control,
-                        const uint8_t value);
-    static void create(Button *place, const uint8_t channel,
-                       const uint8_t control, const uint8_t value);
-  private:
-    uint8_t channel;
-    uint8_t control;
-    uint8_t value;
+    uint8_t intern(const ChordShape &shape);
+    // Free the shapes whose bit isn't set in mask
+    void keep(uint16_t mask) { used = mask; }
+    const ChordShape &operator[](uint8_t index) const { return shapes[index]; }
+    static uint16_t usedBy(const Button *buttons, unsigned count);
+
+    ChordShape shapes[CHORD_SHAPES];
+    // Shapes set so far, those in use have their bit set in used
+    uint8_t count;
+    uint16_t used;
+    // Number of shapes that didn't fit, so that a layout using one can be
+    // rejected
+    uint8_t failures;
 };
+static_assert(CHORD_SHAPES <= 16, "ChordShapes::used is 16 bits");
+
+extern ChordShapes chord_shapes;
+
+#define MAX_NAME_LENGTH 109
+// Buttons of the largest keyboard, the size of the shadow layout and of the
+// buttons of a preset slot. It is the 12 matrix groups of 8 keys: a larger
+// keyboard (120 basses) needs more group pins, and its presets don't fit
+// in the EEPROM.
+#define MAX_KEYBOARD_BUTTONS 96
+// Number of button maps (registers) of each keyboard, each taking
+// BUTTONS * sizeof(Button) bytes of SRAM (see KeyboardGeometry).
+#ifndef KEYBOARD_REGISTERS
+#define KEYBOARD_REGISTERS 2
+#endif
+// Maximum number of channels the bellows expression of a keyboard goes to.
+#define MAX_EXPRESSION_TARGETS 4
 
 /**
-   Union to get the size of the largest Button subclass.
+   A channel the bellows expression is sent to, and the offset added to the
+   expression there, so that the bass doesn't overpower the melody for
+   instance. A channel of 0 is no target.
 */
-union max_button_size {
-  NoteButton s1;
-  ProgramButton s2;
-  ControlButton s3;
+struct ExpressionTarget
+{
+  uint8_t channel;
+  int8_t offset;
 };
 
 /**
-   Class to statically allocate a button, while keeping all the
-   polymorphic gains.
-*/
-class GenericButton
+ * Decodes a layout SysEx into a name and buttons, one byte at a time, so
+ * that it doesn't matter where the message was split into chunks.
+ *
+ * The layout is the base64 encoded name, a 0x00, then the SysEx record of
+ * each button. The name can also be packed: 0x01 (not a base64 character),
+ * the name length, then the name 7 bytes at a time, each group preceded by
+ * a byte holding their high bits (bit 0 for the first byte).
+ * The buttons can be followed by the expression targets: their number,
+ * then the channel and the offset + 64 of each. Without them, the targets
+ * are left as they were.
+ * Bytes with the high bit set can't be data, they are the
+ * 0xF0/0xF7 chunk boundaries added by the MIDI library and are skipped.
+ * A name that isn't valid base64 or is too long is cut there and the rest
+ * of it is skipped. Targets past MAX_EXPRESSION_TARGETS are ignored.
+ */
+class LayoutDecoder
 {
   public:
-    Button *operator->();
-    Button const *operator->() const;
-    // For placement new or delete
-    Button *get();
-    Button const *get() const;
-    GenericButton& operator=(const GenericButton &x);
+    LayoutDecoder() : stage(DECODE_DONE)
+    {};
+    void begin(unsigned char *name, Button *buttons, uint8_t button_count,
+               ExpressionTarget *expression);
+    void feed(byte value);
+    void feed(const byte *data, unsigned size);
+    void clear() { stage = DECODE_DONE; }
+    bool done() const { return stage == DECODE_DONE; }
   private:
-    byte buf[sizeof(union max_button_size)];
-};
+    enum Stage : uint8_t
+    {
+      DECODE_NAME,    // Reading the base64 name
+      DECODE_PACKED_LENGTH, // Reading the length of a packed name
+      DECODE_PACKED,  // Reading a packed name
+      DECODE_JUNK,    // Skipping the rest of a bad name
+      DECODE_BUTTONS, // Reading the button records
+      DECODE_EXPRESSION_COUNT, // Reading the number of expression targets
+      DECODE_EXPRESSION, // Reading the expression targets
+      DECODE_DONE     // The whole layout was read
+    };
+    void nameByte(byte value);
+    void packedByte(byte value);
+    void buttonByte(byte value);
+    void expressionByte(byte value);
 
-#define MAX_NAME_LENGTH 109
+    unsigned char *name;
+    Button *buttons;
+    uint8_t button_count;
+    ExpressionTarget *expression;
+    uint8_t stage;
+    // Name characters or button bytes written so far
+    uint8_t write_pos;
+    // Characters of a packed name or expression targets still to read
+    uint8_t remaining;
+    // Base64 quartet or button record being read
+    byte pending[MAX_BUTTON_RECORD];
+    uint8_t pending_len;
+};
 
 /**
  * Base class to handle keyboards.
  * Defines variable used by all keyboard types.
+ *
+ * A keyboard has KEYBOARD_REGISTERS button maps, its registers, that share
+ * its name and expression targets. keyboard points to the one being played,
+ * so switching registers is a pointer swap. Layouts, buttons, presets and
+ * checksums all apply to the register being played. A register can be
+ * selected, or shifted to only while a button is held.
+ *
+ * The geometry of each keyboard, and the storage of its registers, are
+ * given by KeyboardGeometry.
  */
 class Keyboard
 {
 public:
-  virtual Button* getButton(int grp, int index);
-  size_t nameFromSysEx(const byte* data, unsigned size);
-  virtual size_t buttonsFromSysEx(const byte* data, unsigned size) = 0;
-  virtual void send() = 0;
+  Keyboard(Button *maps) : keyboard(maps), maps(maps), base_register(0),
+                           active_register(0), edit_register(0)
+  {};
+  void clear();
+  virtual const Button* getButton(uint8_t grp, uint8_t index) = 0;
+  void send(bool packed = false);
+  void applyDefault(const byte* layout, size_t size);
+  void sendDefault(const byte* layout, size_t size);
   virtual uint8_t type() = 0;
+  virtual uint8_t buttonCount() = 0;
+  virtual uint8_t columns() = 0;
   void editFromSysEx(const byte* data, unsigned size);
   void clearEdition();
-  void beginNameEdition();
+  void beginEdition();
+  bool commitEdition();
+  int setButtons(uint8_t first, const byte* data, unsigned size);
+  uint8_t getButtons(uint8_t first, uint8_t count, byte* data);
+  uint16_t checksum();
+  uint8_t expressionToBytes(byte* buf);
+  uint8_t activeRegister() const { return active_register; }
+  bool selectRegister(uint8_t reg);
+  bool shiftRegister(uint8_t reg);
+  void releaseShift();
+  bool deriveRegister(uint8_t reg, uint8_t from, int8_t transpose,
+                      uint8_t channel);
+  uint16_t chordShapes();
+  static uint16_t editedChordShapes();
 
   unsigned char name[MAX_NAME_LENGTH];
+  ExpressionTarget expression[MAX_EXPRESSION_TARGETS];
 
-  static size_t write_pos;
-  static bool read_name;
-  static bool read_buttons;
-  static uint8_t pad;
-  static unsigned char temp_bytes[5];
-  static bool read_junk;
-  GenericButton keyboard[12][8];
+  LayoutDecoder decoder;
+  // Shadow layout the SysEx is decoded to, so that the layout being played
+  // is replaced all at once when the whole message was received. There is
+  // a single one, owned by the keyboard editor points to: SRAM is short,
+  // and layouts are received one at a time.
+  static unsigned char edit_name[MAX_NAME_LENGTH];
+  static Button edit_buttons[MAX_KEYBOARD_BUTTONS];
+  static ExpressionTarget edit_expression[MAX_EXPRESSION_TARGETS];
+  static Keyboard *editor;
+  // chord_shapes.failures when the edit began
+  static uint8_t edit_shape_failures;
+  // Register being played
+  Button *keyboard;
+  // Button a key that has none maps to
+  static const Button null_button;
+private:
+  Button* registerMap(uint8_t reg) { return maps + reg * buttonCount(); }
+
+  // The KEYBOARD_REGISTERS maps of buttonCount() buttons, one after the other
+  Button *const maps;
+  // Register selected, and register played (differs while shifted)
+  uint8_t base_register;
+  uint8_t active_register;
+  // Register the layout being received goes to
+  uint8_t edit_register;
 };
 
-/**
-   Right keyboard.
+// Number of keys HeldButtons remembers: every key of the matrix, both
+// keyboards.
+#define MAX_HELD_BUTTONS (GROUP_COUNT * MATRIX_COLUMNS)
 
-   Represent a right button keyboard of 81 button, as 4 rows of 16 buttons
-   and 1 row of 17 buttons.
+/**
+ * Buttons of the keys being held, as they were when the keys were pressed,
+ * so that a key released after a layout change still sends the note-off of
+ * the note it started, and a register button releases its own shift even
+ * if it isn't in the register played anymore. Only the buttons that do
+ * something on release are kept.
+ *
+ * The keys are packed at the start of the table, so that plays(), called
+ * for every note a note-off or layout change could release, only looks at
+ * the keys actually held. A count per channel and note would take 2 KB of
+ * SRAM.
+ */
+class HeldButtons
+{
+  public:
+    HeldButtons() : count(0)
+    {};
+    void press(uint8_t key, const Button &button);
+    bool release(uint8_t key, Button &button);
+    bool plays(uint8_t channel, uint8_t note) const;
+    uint16_t chordShapes() const;
+    uint8_t heldCount() const { return count; }
+    static bool releases(const Button &button);
+  private:
+    uint8_t find(uint8_t key) const;
 
-   A keyboard is made of GenericButton. A GenericButton holds a Button.
-   To create a button, we use the placement new operator :
-     new(kbd.keyboard[i][j].get()) NoteButton(i, j, i+j);
-   This doesn't allocate memory, but use the memory at kbd.keyboard[i][j].get().
+    // The keys held and the button each was pressed with, the first count
+    // entries
+    uint8_t keys[MAX_HELD_BUTTONS];
+    Button buttons[MAX_HELD_BUTTONS];
+    uint8_t count;
+};
 
-*/
-class RightKeyboard: public Keyboard
+/**
+ * A keyboard of BUTTONS buttons wired as ROWS matrix groups of COLUMNS keys,
+ * button n being key n%COLUMNS of group n/COLUMNS. TYPE identifies it in
+ * the SysEx messages.
+ *
+ * Everything is known at compile time: the registers are exactly BUTTONS
+ * long, and calling getButton() on the keyboard itself (rather than
+ * through a Keyboard) is inlined, COLUMNS being a power of 2 the index is
+ * a shift and an or. The SysEx and preset code, which doesn't need the
+ * speed, goes through Keyboard.
+ */
+template<uint8_t TYPE, uint8_t ROWS, uint8_t COLUMNS, uint8_t BUTTONS>
+class KeyboardGeometry: public Keyboard
 {
+  static_assert(ROWS <= GROUP_COUNT, "More rows than matrix groups");
+  static_assert(COLUMNS == 8, "A keyboard reads one 8-bit port per group");
+  static_assert(BUTTONS <= ROWS * COLUMNS, "More buttons than keys");
+  static_assert(BUTTONS <= MAX_KEYBOARD_BUTTONS, "Raise MAX_KEYBOARD_BUTTONS");
   public:
-    RightKeyboard()
-    {};
-    ~RightKeyboard()
+    KeyboardGeometry() : Keyboard(registers[0])
     {};
-    void clear();
-    virtual Button* getButton(int grp, int index);
-    virtual size_t buttonsFromSysEx(const byte* data, unsigned size);
-    virtual uint8_t type();
-    virtual void send();
+    const Button* getButton(uint8_t grp, uint8_t index) final
+    {
+      const uint8_t i = grp * COLUMNS + index;
+      return i < BUTTONS ? &keyboard[i] : &null_button;
+    }
+    uint8_t type() final { return TYPE; }
+    uint8_t buttonCount() final { return BUTTONS; }
+    uint8_t columns() final { return COLUMNS; }
+  private:
+    Button registers[KEYBOARD_REGISTERS][BUTTONS];
 };
 
+/**
+   Right keyboard.
+
+   Represent a right button keyboard of 81 button, as 4 rows of 16 buttons
+   and 1 row of 17 buttons, wired as the 12 groups (the last 15 keys of the
+   matrix are not connected).
+*/
+typedef KeyboardGeometry<0x01, 12, 8, 81> RightKeyboard;
+
+/**
+   Left keyboard.
+
+   Represent a left (bass and chords) keyboard of 96 buttons, as 6 rows of
+   16 buttons. It shares the group pins with the right keyboard and is read
+   on PINC during the same scan.
+*/
+typedef KeyboardGeometry<0x02, 12, 8, 96> LeftKeyboard;
+
+/*
+ * Default layouts, as the SysEx an editor sends to apply them. They are
+ * read straight from flash by applyDefault() and sendDefault().
+ * The expression goes fully to the melody (channel 1), 6 lower to the bass
+ * (channel 2) and 12 lower to the chords (channel 3).
+ */
 const byte right_keyboard_default[] PROGMEM =
   {0xf0, 0x7d, 0x02, 0x01, 0x55, 0x6d, 0x6c, 0x6e, 0x61, 0x48,
    0x51, 0x67, 0x61, 0x32, 0x56, 0x35, 0x59, 0x6d, 0x39, 0x68,
@@ -204,31 +388,74 @@ const byte right_keyboard_default[] PROGMEM =
    0x7f, 0x01, 0x01, 0x3a, 0x7f, 0x01, 0x01, 0x39, 0x7f, 0x01,
    0x01, 0x3a, 0x7f, 0x01, 0x01, 0x3b, 0x7f, 0x01, 0x01, 0x3c,
    0x7f, 0x01, 0x01, 0x3d, 0x7f, 0x01, 0x01, 0x3c, 0x7f, 0x01,
-   0x01, 0x3d, 0x7f, 0x01, 0x01, 0x3e, 0x7f, 0x01, 0x01, 0xf0,
-   0xf7, 0x3f, 0x7f, 0x01, 0x01, 0x40, 0x7f, 0x01, 0x01, 0x3f,
-   0x7f, 0x01, 0x01, 0x40, 0x7f, 0x01, 0x01, 0x41, 0x7f, 0x01,
-   0x01, 0x42, 0x7f, 0x01, 0x01, 0x43, 0x7f, 0x01, 0x01, 0x42,
-   0x7f, 0x01, 0x01, 0x43, 0x7f, 0x01, 0x01, 0x44, 0x7f, 0x01,
-   0x01, 0x45, 0x7f, 0x01, 0x01, 0x46, 0x7f, 0x01, 0x01, 0x45,
-   0x7f, 0x01, 0x01, 0x46, 0x7f, 0x01, 0x01, 0x47, 0x7f, 0x01,
-   0x01, 0x48, 0x7f, 0x01, 0x01, 0x49, 0x7f, 0x01, 0x01, 0x48,
-   0x7f, 0x01, 0x01, 0x49, 0x7f, 0x01, 0x01, 0x4a, 0x7f, 0x01,
-   0x01, 0x4b, 0x7f, 0x01, 0x01, 0x4c, 0x7f, 0x01, 0x01, 0x4b,
-   0x7f, 0x01, 0x01, 0x4c, 0x7f, 0x01, 0x01, 0x4d, 0x7f, 0xf0,
-   0xf7, 0x01, 0x01, 0x4e, 0x7f, 0x01, 0x01, 0x4f, 0x7f, 0x01,
-   0x01, 0x4e, 0x7f, 0x01, 0x01, 0x4f, 0x7f, 0x01, 0x01, 0x50,
-   0x7f, 0x01, 0x01, 0x51, 0x7f, 0x01, 0x01, 0x52, 0x7f, 0x01,
-   0x01, 0x51, 0x7f, 0x01, 0x01, 0x52, 0x7f, 0x01, 0x01, 0x53,
-   0x7f, 0x01, 0x01, 0x54, 0x7f, 0x01, 0x01, 0x55, 0x7f, 0x01,
-   0x01, 0x54, 0x7f, 0x01, 0x01, 0x55, 0x7f, 0x01, 0x01, 0x56,
-   0x7f, 0x01, 0x01, 0x57, 0x7f, 0x01, 0x01, 0x58, 0x7f, 0x01,
-   0x01, 0x57, 0x7f, 0x01, 0x01, 0x58, 0x7f, 0x01, 0x01, 0x59,
-   0x7f, 0x01, 0x01, 0x5a, 0x7f, 0x01, 0x01, 0x5b, 0x7f, 0x01,
-   0x01, 0x5a, 0x7f, 0x01, 0x01, 0x5b, 0x7f, 0x01, 0x01, 0xf0,
-   0xf7, 0x5c, 0x7f, 0x01, 0x01, 0x5d, 0x7f, 0x01, 0x01, 0x5e,
-   0x7f, 0x01, 0x01, 0x5d, 0x7f, 0x01, 0x01, 0x5e, 0x7f, 0x01,
-   0x01, 0x5f, 0x7f, 0x01, 0x01, 0x60, 0x7f, 0x01, 0x01, 0x61,
-   0x7f, 0x01, 0x01, 0x60, 0x7f, 0x01, 0x01, 0x61, 0x7f, 0x01,
-   0x01, 0x62, 0x7f, 0x01, 0x01, 0x63, 0x7f, 0x01, 0x01, 0x63,
-   0x7f, 0x01, 0x01, 0x64, 0x7f, 0xf7};
+   0x01, 0x3d, 0x7f, 0x01, 0x01, 0x3e, 0x7f, 0x01, 0x01, 0x3f,
+   0x7f, 0x01, 0x01, 0x40, 0x7f, 0x01, 0x01, 0x3f, 0x7f, 0x01,
+   0x01, 0x40, 0x7f, 0x01, 0x01, 0x41, 0x7f, 0x01, 0x01, 0x42,
+   0x7f, 0x01, 0x01, 0x43, 0x7f, 0x01, 0x01, 0x42, 0x7f, 0x01,
+   0x01, 0x43, 0x7f, 0x01, 0x01, 0x44, 0x7f, 0x01, 0x01, 0x45,
+   0x7f, 0x01, 0x01, 0x46, 0x7f, 0x01, 0x01, 0x45, 0x7f, 0x01,
+   0x01, 0x46, 0x7f, 0x01, 0x01, 0x47, 0x7f, 0x01, 0x01, 0x48,
+   0x7f, 0x01, 0x01, 0x49, 0x7f, 0x01, 0x01, 0x48, 0x7f, 0x01,
+   0x01, 0x49, 0x7f, 0x01, 0x01, 0x4a, 0x7f, 0x01, 0x01, 0x4b,
+   0x7f, 0x01, 0x01, 0x4c, 0x7f, 0x01, 0x01, 0x4b, 0x7f, 0x01,
+   0x01, 0x4c, 0x7f, 0x01, 0x01, 0x4d, 0x7f, 0x01, 0x01, 0x4e,
+   0x7f, 0x01, 0x01, 0x4f, 0x7f, 0x01, 0x01, 0x4e, 0x7f, 0x01,
+   0x01, 0x4f, 0x7f, 0x01, 0x01, 0x50, 0x7f, 0x01, 0x01, 0x51,
+   0x7f, 0x01, 0x01, 0x52, 0x7f, 0x01, 0x01, 0x51, 0x7f, 0x01,
+   0x01, 0x52, 0x7f, 0x01, 0x01, 0x53, 0x7f, 0x01, 0x01, 0x54,
+   0x7f, 0x01, 0x01, 0x55, 0x7f, 0x01, 0x01, 0x54, 0x7f, 0x01,
+   0x01, 0x55, 0x7f, 0x01, 0x01, 0x56, 0x7f, 0x01, 0x01, 0x57,
+   0x7f, 0x01, 0x01, 0x58, 0x7f, 0x01, 0x01, 0x57, 0x7f, 0x01,
+   0x01, 0x58, 0x7f, 0x01, 0x01, 0x59, 0x7f, 0x01, 0x01, 0x5a,
+   0x7f, 0x01, 0x01, 0x5b, 0x7f, 0x01, 0x01, 0x5a, 0x7f, 0x01,
+   0x01, 0x5b, 0x7f, 0x01, 0x01, 0x5c, 0x7f, 0x01, 0x01, 0x5d,
+   0x7f, 0x01, 0x01, 0x5e, 0x7f, 0x01, 0x01, 0x5d, 0x7f, 0x01,
+   0x01, 0x5e, 0x7f, 0x01, 0x01, 0x5f, 0x7f, 0x01, 0x01, 0x60,
+   0x7f, 0x01, 0x01, 0x61, 0x7f, 0x01, 0x01, 0x60, 0x7f, 0x01,
+   0x01, 0x61, 0x7f, 0x01, 0x01, 0x62, 0x7f, 0x01, 0x01, 0x63,
+   0x7f, 0x01, 0x01, 0x63, 0x7f, 0x01, 0x01, 0x64, 0x7f, 0x01,
+   0x01, 0x40, 0xf7};
+const byte left_keyboard_default[] PROGMEM =
+  {0xf0, 0x7d, 0x02, 0x02, 0x54, 0x47, 0x56, 0x6d, 0x64, 0x43,
+   0x42, 0x72, 0x5a, 0x58, 0x6c, 0x69, 0x62, 0x32, 0x46, 0x79,
+   0x5a, 0x41, 0x3d, 0x3d, 0x00, 0x01, 0x02, 0x2c, 0x7f, 0x01,
+   0x02, 0x27, 0x7f, 0x01, 0x02, 0x2e, 0x7f, 0x01, 0x02, 0x29,
+   0x7f, 0x01, 0x02, 0x24, 0x7f, 0x01, 0x02, 0x2b, 0x7f, 0x01,
+   0x02, 0x26, 0x7f, 0x01, 0x02, 0x2d, 0x7f, 0x01, 0x02, 0x28,
+   0x7f, 0x01, 0x02, 0x2f, 0x7f, 0x01, 0x02, 0x2a, 0x7f, 0x01,
+   0x02, 0x25, 0x7f, 0x01, 0x02, 0x2c, 0x7f, 0x01, 0x02, 0x27,
+   0x7f, 0x01, 0x02, 0x2e, 0x7f, 0x01, 0x02, 0x29, 0x7f, 0x01,
+   0x02, 0x28, 0x7f, 0x01, 0x02, 0x2f, 0x7f, 0x01, 0x02, 0x2a,
+   0x7f, 0x01, 0x02, 0x25, 0x7f, 0x01, 0x02, 0x2c, 0x7f, 0x01,
+   0x02, 0x27, 0x7f, 0x01, 0x02, 0x2e, 0x7f, 0x01, 0x02, 0x29,
+   0x7f, 0x01, 0x02, 0x24, 0x7f, 0x01, 0x02, 0x2b, 0x7f, 0x01,
+   0x02, 0x26, 0x7f, 0x01, 0x02, 0x2d, 0x7f, 0x01, 0x02, 0x28,
+   0x7f, 0x01, 0x02, 0x2f, 0x7f, 0x01, 0x02, 0x2a, 0x7f, 0x01,
+   0x02, 0x25, 0x7f, 0x01, 0x03, 0x34, 0x7f, 0x01, 0x03, 0x3b,
+   0x7f, 0x01, 0x03, 0x36, 0x7f, 0x01, 0x03, 0x31, 0x7f, 0x01,
+   0x03, 0x38, 0x7f, 0x01, 0x03, 0x33, 0x7f, 0x01, 0x03, 0x3a,
+   0x7f, 0x01, 0x03, 0x35, 0x7f, 0x01, 0x03, 0x30, 0x7f, 0x01,
+   0x03, 0x37, 0x7f, 0x01, 0x03, 0x32, 0x7f, 0x01, 0x03, 0x39,
+   0x7f, 0x01, 0x03, 0x34, 0x7f, 0x01, 0x03, 0x3b, 0x7f, 0x01,
+   0x03, 0x36, 0x7f, 0x01, 0x03, 0x31, 0x7f, 0x01, 0x03, 0x34,
+   0x7f, 0x01, 0x03, 0x3b, 0x7f, 0x01, 0x03, 0x36, 0x7f, 0x01,
+   0x03, 0x31, 0x7f, 0x01, 0x03, 0x38, 0x7f, 0x01, 0x03, 0x33,
+   0x7f, 0x01, 0x03, 0x3a, 0x7f, 0x01, 0x03, 0x35, 0x7f, 0x01,
+   0x03, 0x30, 0x7f, 0x01, 0x03, 0x37, 0x7f, 0x01, 0x03, 0x32,
+   0x7f, 0x01, 0x03, 0x39, 0x7f, 0x01, 0x03, 0x34, 0x7f, 0x01,
+   0x03, 0x3b, 0x7f, 0x01, 0x03, 0x36, 0x7f, 0x01, 0x03, 0x31,
+   0x7f, 0x01, 0x03, 0x34, 0x7f, 0x01, 0x03, 0x3b, 0x7f, 0x01,
+   0x03, 0x36, 0x7f, 0x01, 0x03, 0x31, 0x7f, 0x01, 0x03, 0x38,
+   0x7f, 0x01, 0x03, 0x33, 0x7f, 0x01, 0x03, 0x3a, 0x7f, 0x01,
+   0x03, 0x35, 0x7f, 0x01, 0x03, 0x30, 0x7f, 0x01, 0x03, 0x37,
+   0x7f, 0x01, 0x03, 0x32, 0x7f, 0x01, 0x03, 0x39, 0x7f, 0x01,
+   0x03, 0x34, 0x7f, 0x01, 0x03, 0x3b, 0x7f, 0x01, 0x03, 0x36,
+   0x7f, 0x01, 0x03, 0x31, 0x7f, 0x01, 0x03, 0x34, 0x7f, 0x01,
+   0x03, 0x3b, 0x7f, 0x01, 0x03, 0x36, 0x7f, 0x01, 0x03, 0x31,
+   0x7f, 0x01, 0x03, 0x38, 0x7f, 0x01, 0x03, 0x33, 0x7f, 0x01,
+   0x03, 0x3a, 0x7f, 0x01, 0x03, 0x35, 0x7f, 0x01, 0x03, 0x30,
+   0x7f, 0x01, 0x03, 0x37, 0x7f, 0x01, 0x03, 0x32, 0x7f, 0x01,
+   0x03, 0x39, 0x7f, 0x01, 0x03, 0x34, 0x7f, 0x01, 0x03, 0x3b,
+   0x7f, 0x01, 0x03, 0x36, 0x7f, 0x01, 0x03, 0x31, 0x7f, 0x02,
+   0x02, 0x3a, 0x03, 0x34, 0xf7};
 #endif //__KEYBOARD_H__
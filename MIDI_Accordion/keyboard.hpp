@@ -21,404 +21,742 @@
 #include "keyboard.h"
 #include <base64.hpp>
 
-uint8_t NullButton::toBytes(byte *buf)
-{
-  if(buf)
-    buf[0] = 0x00;
-  return 1;
-}
+ChordShapes chord_shapes;
 
-void NoteButton::on()
-{
-  #ifdef DEBUG
-  Serial.print("on: ");
-  Serial.println(pitch);
-  #else
-  MIDI.sendNoteOn(pitch, velocity, channel);
-  #endif //DEBUG
-}
-void NoteButton::off()
+/**
+ * Index of a shape in the pool, added in the place of a free one or at the
+ * end if it isn't there yet. Return CHORD_SHAPES if the pool is full.
+ */
+uint8_t ChordShapes::intern(const ChordShape &shape)
 {
-  #ifdef DEBUG
-  Serial.print("off: ");
-  Serial.println(pitch);
-  #else
-  MIDI.sendNoteOff(pitch, velocity, channel);
-  #endif //DEBUG
-}
-uint8_t NoteButton::toBytes(byte *buf)
-{
-  if(buf) {
-    buf[0] = 0x01;
-    buf[1] = channel;
-    buf[2] = pitch;
-    buf[3] = velocity;
+  uint8_t index = CHORD_SHAPES;
+  for(uint8_t i=0; i<count; i++) {
+    if(!memcmp(&shapes[i], &shape, sizeof(shape))) {
+      used |= 1 << i;
+      return i;
+    }
+    if(index == CHORD_SHAPES && !(used & (1 << i)))
+      index = i;
   }
-  return 4;
-}
-bool NoteButton::isValid(const uint8_t channel, const uint8_t pitch,
-                                const uint8_t velocity)
-{
-  return channel < 16 && pitch < 128 && velocity < 128;
+  if(index == CHORD_SHAPES) {
+    if(count == CHORD_SHAPES) {
+      failures++;
+      return CHORD_SHAPES;
+    }
+    index = count++;
+  }
+  shapes[index] = shape;
+  used |= 1 << index;
+  return index;
 }
-void NoteButton::create(Button *place, const uint8_t channel,
-                               const uint8_t pitch, const uint8_t velocity)
+/**
+ * Mask of the shapes used by the chord buttons among count buttons.
+ */
+uint16_t ChordShapes::usedBy(const Button *buttons, unsigned count)
 {
-  if(!isValid(channel, pitch, velocity)) {
-    // A value is bad, skip
-    new(place) NullButton();
-  }
-  else {
-    new(place) NoteButton(channel, pitch, velocity);
+  uint16_t mask = 0;
+  for(unsigned i=0; i<count; i++) {
+    if(buttons[i].type == CHORD_BUTTON && buttons[i].message[2] < CHORD_SHAPES)
+      mask |= 1 << buttons[i].message[2];
   }
+  return mask;
 }
 
-void ProgramButton::on()
-{
-  #ifdef DEBUG
-  Serial.print("program: ");
-  Serial.println(program);
-  #else
-  MIDI.sendProgramChange(program, channel);
-  #endif //DEBUG
-}
-void ProgramButton::off()
+/**
+ * Send the message of the button. A note already sounding (played by
+ * another button) is not started again, so that it isn't stacked on the
+ * synth and a single note-off ends it.
+ */
+void Button::on() const
 {
+  switch(type)
+  {
+  case NOTE_BUTTON:
+    #ifdef DEBUG
+    Serial.print("on: ");
+    Serial.println(message[1]);
+    #else
+    if(!midi_out.activeNotes().isOn(message[0] & 0x0F, message[1]))
+      midi_out.send(message);
+    #endif //DEBUG
+    break;
+  case PROGRAM_BUTTON:
+    #ifdef DEBUG
+    Serial.print("program: ");
+    Serial.println(message[1]);
+    #else
+    midi_out.send(message);
+    #endif //DEBUG
+    break;
+  case CONTROL_BUTTON:
+    #ifdef DEBUG
+    Serial.print("control: ");
+    Serial.println(message[1]);
+    #else
+    midi_out.send(message);
+    #endif //DEBUG
+    break;
+  case CHORD_BUTTON:
+    #ifdef DEBUG
+    Serial.print("chord: ");
+    Serial.println(message[1]);
+    #else
+    {
+      // Queued back to back, they leave in one burst
+      byte notes[MAX_CHORD_NOTES];
+      const uint8_t count = this->notes(notes);
+      byte note_on[3] = {message[0], 0,
+                         chord_shapes[message[2]].velocity};
+      for(uint8_t i=0; i<count; i++) {
+        if(midi_out.activeNotes().isOn(message[0] & 0x0F, notes[i]))
+          continue;
+        note_on[1] = notes[i];
+        midi_out.send(note_on);
+      }
+    }
+    #endif //DEBUG
+    break;
+  }
 }
-uint8_t ProgramButton::toBytes(byte *buf)
+/**
+ * Release the notes of the button, except those keep returns true for (keep
+ * may be null), so that a note still played by another button isn't cut.
+ */
+void Button::off(bool (*keep)(uint8_t channel, uint8_t note)) const
 {
-  if(buf) {
-    buf[0] = 0x02;
-    buf[1] = channel;
-    buf[2] = program;
+  if(type == NOTE_BUTTON || type == CHORD_BUTTON) {
+    #ifdef DEBUG
+    Serial.print("off: ");
+    Serial.println(message[1]);
+    #else
+    byte notes[MAX_CHORD_NOTES];
+    const uint8_t count = this->notes(notes);
+    byte note_off[3] = {(byte)(message[0] - 0x10), 0,
+                        type == NOTE_BUTTON ? message[2] : (byte)0x40};
+    for(uint8_t i=0; i<count; i++) {
+      if(keep && keep(message[0] & 0x0F, notes[i]))
+        continue;
+      note_off[1] = notes[i];
+      midi_out.send(note_off);
+    }
+    #endif //DEBUG
   }
-  return 3;
+  else
+    (void)keep;
 }
-bool ProgramButton::isValid(const uint8_t channel, const uint8_t program)
+/**
+ * Write the notes the button plays to notes, MAX_CHORD_NOTES at most, and
+ * return how many there are.
+ */
+uint8_t Button::notes(byte *notes) const
 {
-  return channel < 16 && program < 128;
-};
-void ProgramButton::create(Button *place, const uint8_t channel,
-                                  const uint8_t program)
-{
-  if(!isValid(channel, program)) {
-    // A value is bad, skip
-    new(place) NullButton();
+  if(type == NOTE_BUTTON) {
+    notes[0] = message[1];
+    return 1;
   }
-  else {
-    new(place) ProgramButton(channel, program);
+  if(type != CHORD_BUTTON)
+    return 0;
+  const ChordShape &shape = chord_shapes[message[2]];
+  uint8_t count = 0;
+  notes[count++] = message[1];
+  for(uint8_t i=0; i<MAX_CHORD_NOTES-1; i++) {
+    if(shape.intervals[i] && message[1] + shape.intervals[i] < 128)
+      notes[count++] = message[1] + shape.intervals[i];
   }
-};
-
-void ControlButton::on()
-{
-  #ifdef DEBUG
-  Serial.print("control: ");
-  Serial.println(control);
-  #else
-  MIDI.sendControlChange(control, value, channel);
-  #endif //DEBUG
-}
-void ControlButton::off()
-{
+  return count;
 }
-uint8_t ControlButton::toBytes(byte *buf)
+/**
+   Write the SysEx record of the button to buf (if not null) and return its
+   length.
+*/
+uint8_t Button::toBytes(byte *buf) const
 {
+  const uint8_t len = length(type);
   if(buf) {
-    buf[0] = 0x03;
-    buf[1] = channel;
-    buf[2] = control;
-    buf[3] = value;
+    buf[0] = type;
+    if(type == PRESET_BUTTON || type == REGISTER_BUTTON) {
+      memcpy(buf+1, message, len-1);
+    }
+    else if(type == CHORD_BUTTON) {
+      const ChordShape &shape = chord_shapes[message[2]];
+      buf[1] = (message[0] & 0x0F) + 1;
+      buf[2] = message[1];
+      buf[3] = shape.velocity;
+      memcpy(buf+4, shape.intervals, MAX_CHORD_NOTES-1);
+    }
+    else if(len > 1) {
+      // Status byte 0xXn is channel n+1
+      buf[1] = (message[0] & 0x0F) + 1;
+      memcpy(buf+2, message+1, len-2);
+    }
   }
-  return 4;
-}
-bool ControlButton::isValid(const uint8_t channel, const uint8_t control,
-                                   const uint8_t value)
-{
-  return channel < 16 && control < 128 && value < 128;
+  return len;
 }
-void ControlButton::create(Button *place, const uint8_t channel,
-                                  const uint8_t control, const uint8_t value)
+/**
+   Length of the SysEx record of a button of the given type, type included.
+   Unknown types are read as a NullButton.
+*/
+uint8_t Button::length(const uint8_t type)
 {
-  if(!isValid(channel, control, value)) {
-    // A value is bad, skip
-    new(place) NullButton();
-  }
-  else {
-    new(place) ControlButton(channel, control, value);
+  switch(type)
+  {
+  case NOTE_BUTTON:
+  case CONTROL_BUTTON:
+  case REGISTER_BUTTON:
+    return 4;
+  case CHORD_BUTTON:
+    return MAX_BUTTON_RECORD;
+  case PROGRAM_BUTTON:
+  case PRESET_BUTTON:
+    return 3;
+  default:
+    return 1;
   }
 }
-
-Button *GenericButton::operator->() {
-  return (Button *)buf;
-}
-Button const *GenericButton::operator->() const {
-  return (Button const *)buf;
-}
-Button *GenericButton::get() {
-  return (Button *)buf;
-}
-Button const *GenericButton::get() const {
-  return (Button const *)buf;
+/**
+   Channel of a SysEx record, 1 to 16. Channel 0 never sent anything (the
+   MIDI library drops it), its buttons are read as NullButtons.
+*/
+static inline bool valid_channel(byte channel)
+{
+  return channel >= 1 && channel <= 16;
 }
-GenericButton& GenericButton::operator=(const GenericButton &x)
+/**
+   Read a button from its SysEx record. A record with a bad value gives a
+   NullButton.
+*/
+Button Button::fromBytes(const byte *buf)
 {
-  if (&x != this)
-    memcpy(this, &x, sizeof(*this));
-  return *this;
+  Button button = {NULL_BUTTON, {0, 0, 0}};
+  switch(buf[0])
+  {
+  case NOTE_BUTTON:
+  case CONTROL_BUTTON:
+    if(valid_channel(buf[1]) && buf[2] < 128 && buf[3] < 128) {
+      button.type = buf[0];
+      button.message[0] = (buf[0] == NOTE_BUTTON ? 0x90 : 0xB0)
+                          | (buf[1] - 1);
+      button.message[1] = buf[2];
+      button.message[2] = buf[3];
+    }
+    break;
+  case PROGRAM_BUTTON:
+    if(valid_channel(buf[1]) && buf[2] < 128) {
+      button.type = buf[0];
+      button.message[0] = 0xC0 | (buf[1] - 1);
+      button.message[1] = buf[2];
+    }
+    break;
+  case PRESET_BUTTON:
+    if((buf[1] == 0x01 || buf[1] == 0x02) && buf[2] < 128) {
+      button.type = buf[0];
+      button.message[0] = buf[1];
+      button.message[1] = buf[2];
+    }
+    break;
+  case PANIC_BUTTON:
+    button.type = buf[0];
+    break;
+  case REGISTER_BUTTON:
+    if((buf[1] == 0x01 || buf[1] == 0x02) && buf[2] < 128 && buf[3] < 2) {
+      button.type = buf[0];
+      memcpy(button.message, buf+1, 3);
+    }
+    break;
+  case CHORD_BUTTON:
+    if(valid_channel(buf[1]) && buf[2] < 128 && buf[3] < 128 && buf[4] < 128
+       && buf[5] < 128 && buf[6] < 128) {
+      ChordShape shape;
+      memcpy(shape.intervals, buf+4, MAX_CHORD_NOTES-1);
+      shape.velocity = buf[3];
+      const uint8_t index = chord_shapes.intern(shape);
+      if(index < CHORD_SHAPES) {
+        button.type = buf[0];
+        button.message[0] = 0x90 | (buf[1] - 1);
+        button.message[1] = buf[2];
+        button.message[2] = index;
+      }
+    }
+    break;
+  }
+  return button;
 }
 
-void Keyboard::clearEdition() {
+/**
+ * Start reading a layout: the name and buttons, from the start.
+ */
+void LayoutDecoder::begin(unsigned char *name, Button *buttons,
+                          uint8_t button_count, ExpressionTarget *expression)
+{
+  this->name = name;
+  this->buttons = buttons;
+  this->button_count = button_count;
+  this->expression = expression;
+  stage = DECODE_NAME;
   write_pos = 0;
-  read_name = false;
-  read_buttons = false;
-  pad = 0;
-  read_junk = false;
+  pending_len = 0;
+  name[0] = '\0';
 }
-void Keyboard::beginNameEdition() {
-  write_pos = 0;
-  pad = 0;
-  read_name = true;
-}
-size_t Keyboard::write_pos = 0;
-bool Keyboard::read_name = false;
-bool Keyboard::read_buttons = false;
-uint8_t Keyboard::pad = 0;
-unsigned char Keyboard::temp_bytes[5] = {0,0,0,0,0};
-bool Keyboard::read_junk = false;
-void Keyboard::editFromSysEx(const byte* data, unsigned size) {
-  if(read_name) {
-    size_t pos = nameFromSysEx(data, size);
-    data += pos;
-    size -= pos;
-    if(!read_name) { // Name is done
-      read_buttons = true;
+void LayoutDecoder::feed(const byte *data, unsigned size)
+{
+  for(unsigned i=0; i<size && stage != DECODE_DONE; i++)
+    feed(data[i]);
+}
+void LayoutDecoder::feed(byte value)
+{
+  if(value & 0x80) // Chunk boundary
+    return;
+  switch(stage)
+  {
+  case DECODE_NAME:
+    nameByte(value);
+    break;
+  case DECODE_PACKED_LENGTH:
+    remaining = value;
+    stage = remaining ? DECODE_PACKED : DECODE_JUNK;
+    break;
+  case DECODE_PACKED:
+    packedByte(value);
+    break;
+  case DECODE_JUNK:
+    if(value == 0x00) {
+      stage = DECODE_BUTTONS;
       write_pos = 0;
-      pad = 0;
+      pending_len = 0;
     }
-  }
-  if(read_buttons) {
-    buttonsFromSysEx(data, size);
+    break;
+  case DECODE_BUTTONS:
+    buttonByte(value);
+    break;
+  case DECODE_EXPRESSION_COUNT:
+    memset(expression, 0, MAX_EXPRESSION_TARGETS * sizeof(ExpressionTarget));
+    remaining = value;
+    write_pos = 0;
+    stage = remaining ? DECODE_EXPRESSION : DECODE_DONE;
+    break;
+  case DECODE_EXPRESSION:
+    expressionByte(value);
+    break;
   }
 }
-size_t Keyboard::nameFromSysEx(const byte* data, unsigned size) {
-  // Get the end of the name
-  size_t i;
-  for(i=0; data[i] != 0x00 && i < size; i++);
-  if(read_junk) { // The last chunck was bad
-    if(i==size) { // Current chunck is bad
-      return size;
-    }
-    else {
-      read_junk = false;
-      return i+1;
-    }
+void LayoutDecoder::nameByte(byte value)
+{
+  if(value == 0x01 && write_pos == 0 && pending_len == 0) { // Packed name
+    stage = DECODE_PACKED_LENGTH;
+    return;
   }
-  if(i==size) { // The name is not over but the chunck is
-    if(pad) { // The last chunck ended abruptly
-      memcpy(temp_bytes+pad, data, 4-pad);
-      write_pos += decode_base64(temp_bytes, 4,
-                                 name+write_pos);
-      name[write_pos] = '\0';
-      data += 4-pad;
-      i -= 4-pad;
+  const bool end = value == 0x00;
+  if(!end) {
+    const bool base64 = (value >= 'A' && value <= 'Z')
+      || (value >= 'a' && value <= 'z') || (value >= '0' && value <= '9')
+      || value == '+' || value == '/' || value == '=';
+    if(!base64) {
+      stage = DECODE_JUNK;
+      return;
     }
-    read_name = true;
-    pad = i%4; // Get the number of bytes that goes with the next chunck
-    size_t decode_len = min(i - pad,
-                            (MAX_NAME_LENGTH - 1 - write_pos)/3*4);
-    size_t len = decode_base64((unsigned char*)data, decode_len,
-                               name+write_pos);
-    write_pos += len;
+    pending[pending_len++] = value;
+  }
+  // Decode each complete quartet, and what is left at the end of the name
+  if(pending_len == 4 || (end && pending_len > 0)) {
+    unsigned char decoded[4]; // Room for a null terminator
+    const uint8_t len = decode_base64(pending, pending_len, decoded);
+    const uint8_t room = MAX_NAME_LENGTH - 1 - write_pos;
+    memcpy(name + write_pos, decoded, min(len, room));
+    write_pos += min(len, room);
     name[write_pos] = '\0';
-    if(len < decode_len/4*3 // The base64 string is corrupted
-       || decode_len < i - pad) { // The base64 string is too long
-      read_junk = true;
-      return encode_base64_length(len);
+    pending_len = 0;
+    if(len > room) { // The name is too long
+      stage = DECODE_JUNK;
+      return;
     }
-    memcpy(temp_bytes, data+i-pad, pad);
-    return size;
   }
-  else {
-    if(pad) { // The last chunck ended abruptly
-      memcpy(temp_bytes+pad, data, 4-pad);
-      write_pos += decode_base64(temp_bytes, 4,
-                                 name+write_pos);
-      name[write_pos] = '\0';
-      data += 4-pad;
-      i -= 4-pad;
-    }
-    size_t decode_len = min(i,
-                            (MAX_NAME_LENGTH - 1 - write_pos)/3*4);
-    write_pos += decode_base64(data, decode_len,
-                               name+write_pos);
-    name[write_pos] = '\0';
+  if(end) {
+    stage = DECODE_BUTTONS;
     write_pos = 0;
-    read_name = false;
-    return i+1;
   }
 }
-
-void RightKeyboard::clear()
+void LayoutDecoder::packedByte(byte value)
 {
-  for (auto& row : keyboard)
-  {
-    for (GenericButton& button : row)
-    {
-      button->~Button();
-    }
+  if(pending_len == 0) { // High bits of the next 7 characters
+    pending[0] = value;
+    pending_len = 1;
+    return;
   }
+  if(write_pos < MAX_NAME_LENGTH - 1) {
+    name[write_pos++] = value | ((pending[0] << (8 - pending_len)) & 0x80);
+    name[write_pos] = '\0';
+  }
+  pending_len = pending_len == 7 ? 0 : pending_len + 1;
+  // The 0x00 after the name is skipped as junk
+  if(--remaining == 0)
+    stage = DECODE_JUNK;
 }
-Button* RightKeyboard::getButton(int grp, int index)
+void LayoutDecoder::buttonByte(byte value)
 {
-  return keyboard[grp][index].get();
+  pending[pending_len++] = value;
+  if(pending_len < Button::length(pending[0]))
+    return;
+  buttons[write_pos++] = Button::fromBytes(pending);
+  pending_len = 0;
+  if(write_pos == button_count) // End of keyboard
+    stage = DECODE_EXPRESSION_COUNT;
 }
-uint8_t RightKeyboard::type() {
-  return 0x01;
+void LayoutDecoder::expressionByte(byte value)
+{
+  pending[pending_len++] = value;
+  if(pending_len < 2)
+    return;
+  if(write_pos < MAX_EXPRESSION_TARGETS) {
+    expression[write_pos].channel = pending[0] <= 16 ? pending[0] : 0;
+    expression[write_pos].offset = (int8_t)pending[1] - 64;
+    write_pos++;
+  }
+  pending_len = 0;
+  if(--remaining == 0)
+    stage = DECODE_DONE;
 }
-size_t RightKeyboard::buttonsFromSysEx(const byte* data, unsigned size) {
-  size_t i=0;
-  if(pad) {
-    switch(temp_bytes[0])
-    {
-    case 0x01:
-      memcpy(temp_bytes+pad, data, 4-pad);
-      NoteButton::create(keyboard[write_pos/8][write_pos%8].get(),
-                         temp_bytes[1], temp_bytes[2], temp_bytes[3]);
-      i += 4-pad;
-      break;
-    case 0x02:
-      memcpy(temp_bytes+pad, data, 3-pad);
-      ProgramButton::create(keyboard[write_pos/8][write_pos%8].get(),
-                         temp_bytes[1], temp_bytes[2]);
-      i += 3-pad;
-      break;
-    case 0x03:
-      memcpy(temp_bytes+pad, data, 4-pad);
-      ControlButton::create(keyboard[write_pos/8][write_pos%8].get(),
-                         temp_bytes[1], temp_bytes[2], temp_bytes[3]);
-      i += 4-pad;
-      break;
+
+void Keyboard::clearEdition() {
+  decoder.clear();
+  if(editor == this)
+    editor = nullptr;
+}
+/**
+ * Start receiving a layout. It is decoded to the shadow layout, and the
+ * buttons the message doesn't set are kept. A layout another keyboard was
+ * receiving is dropped.
+ */
+void Keyboard::beginEdition() {
+  if(editor && editor != this)
+    editor->clearEdition();
+  editor = this;
+  edit_shape_failures = chord_shapes.failures;
+  edit_register = active_register;
+  memcpy(edit_buttons, keyboard, buttonCount() * sizeof(Button));
+  memcpy(edit_expression, expression, sizeof(expression));
+  decoder.begin(edit_name, edit_buttons, buttonCount(), edit_expression);
+}
+/**
+ * Replace the layout with the one received. Called once the end of the
+ * SysEx was received. Return false, changing nothing, if the layout was
+ * dropped in between or if its chord shapes didn't fit in the pool.
+ */
+bool Keyboard::commitEdition() {
+  if(editor != this)
+    return false;
+  if(chord_shapes.failures != edit_shape_failures) {
+    clearEdition();
+    return false;
+  }
+  memcpy(name, edit_name, sizeof(name));
+  memcpy(registerMap(edit_register), edit_buttons,
+         buttonCount() * sizeof(Button));
+  memcpy(expression, edit_expression, sizeof(expression));
+  clearEdition();
+  return true;
+}
+unsigned char Keyboard::edit_name[MAX_NAME_LENGTH];
+Button Keyboard::edit_buttons[MAX_KEYBOARD_BUTTONS];
+ExpressionTarget Keyboard::edit_expression[MAX_EXPRESSION_TARGETS];
+Keyboard *Keyboard::editor = nullptr;
+uint8_t Keyboard::edit_shape_failures = 0;
+void Keyboard::editFromSysEx(const byte* data, unsigned size) {
+  decoder.feed(data, size);
+}
+
+const Button Keyboard::null_button = {NULL_BUTTON, {0, 0, 0}};
+
+void Keyboard::clear()
+{
+  memset(maps, 0, KEYBOARD_REGISTERS * buttonCount() * sizeof(Button));
+}
+/**
+ * Replace the buttons from first onward with the SysEx records in data.
+ * Nothing is changed if a record is cut, goes past the last button or if
+ * a chord shape doesn't fit in the pool. Return the number of buttons set,
+ * or -1.
+ */
+int Keyboard::setButtons(uint8_t first, const byte* data, unsigned size) {
+  // Check the whole message before changing anything, adding its chord
+  // shapes to the pool
+  const uint8_t failures = chord_shapes.failures;
+  unsigned count = 0;
+  for(unsigned i=0; i<size; i+=Button::length(data[i])) {
+    if(i + Button::length(data[i]) > size || first + count >= buttonCount())
+      return -1;
+    if(data[i] == CHORD_BUTTON)
+      Button::fromBytes(data+i);
+    count++;
+  }
+  if(chord_shapes.failures != failures)
+    return -1;
+  for(unsigned i=0; i<size; i+=Button::length(data[i]))
+    keyboard[first++] = Button::fromBytes(data+i);
+  return count;
+}
+/**
+ * Write the SysEx records of count buttons from first onward to data.
+ * Return the number of bytes written.
+ */
+uint8_t Keyboard::getButtons(uint8_t first, uint8_t count, byte* data) {
+  uint8_t size = 0;
+  for(uint8_t i=first; i<buttonCount() && i<first+count; i++)
+    size += keyboard[i].toBytes(data+size);
+  return size;
+}
+/**
+ * Play register reg from now on. Return false if there is no such register.
+ */
+bool Keyboard::selectRegister(uint8_t reg) {
+  if(reg >= KEYBOARD_REGISTERS)
+    return false;
+  base_register = active_register = reg;
+  keyboard = registerMap(reg);
+  return true;
+}
+/**
+ * Play register reg until releaseShift() is called.
+ */
+bool Keyboard::shiftRegister(uint8_t reg) {
+  if(reg >= KEYBOARD_REGISTERS)
+    return false;
+  active_register = reg;
+  keyboard = registerMap(reg);
+  return true;
+}
+/**
+ * Go back to the register selected before the shift.
+ */
+void Keyboard::releaseShift() {
+  active_register = base_register;
+  keyboard = registerMap(base_register);
+}
+/**
+ * Fill register reg with the buttons of register from, the notes (and
+ * chord roots) transposed by transpose semitones and, unless channel is 0,
+ * the MIDI messages moved to channel. Notes transposed out of range become
+ * NullButtons.
+ */
+bool Keyboard::deriveRegister(uint8_t reg, uint8_t from, int8_t transpose,
+                              uint8_t channel) {
+  if(reg >= KEYBOARD_REGISTERS || from >= KEYBOARD_REGISTERS || channel > 16)
+    return false;
+  for(uint8_t i=0; i<buttonCount(); i++) {
+    Button button = registerMap(from)[i];
+    if(button.type == NOTE_BUTTON || button.type == CHORD_BUTTON) {
+      const int note = button.message[1] + transpose;
+      if(note < 0 || note > 127)
+        button.type = NULL_BUTTON;
+      button.message[1] = note;
     }
-    pad = 0;
-    write_pos++;
+    if(channel && (button.type == NOTE_BUTTON
+                   || button.type == PROGRAM_BUTTON
+                   || button.type == CONTROL_BUTTON
+                   || button.type == CHORD_BUTTON))
+      button.message[0] = (button.message[0] & 0xF0) | (channel - 1);
+    registerMap(reg)[i] = button;
   }
-  for(;i<size && write_pos<81; write_pos++) {
-    switch(data[i])
-    {
-    case 0x01: // NoteButton
-      if(size - i < 4) { // This chunk end abruptly
-        pad = size - i;
-        memcpy(temp_bytes, data+i, pad);
-        return size;
-      }
-      NoteButton::create(keyboard[write_pos/8][write_pos%8].get(),
-                         data[i+1], data[i+2], data[i+3]);
-      i += 4;
-      break;
-    case 0x02: //ProgramButton
-      if(size - i < 3) { // This chunk end abruptly
-        pad = size - i;
-        memcpy(temp_bytes, data+i, pad);
-        return size;
-      }
-      ProgramButton::create(keyboard[write_pos/8][write_pos%8].get(),
-                         data[i+1], data[i+2]);
-      i += 3;
-      break;
-    case 0x03: //ControlButton
-      if(size - i < 4) { // This chunk end abruptly
-        pad = size - i;
-        memcpy(temp_bytes, data+i, pad);
-        return size;
-      }
-      ControlButton::create(keyboard[write_pos/8][write_pos%8].get(),
-                         data[i+1], data[i+2], data[i+3]);
-      i += 4;
-      break;
-    default:
-      new(keyboard[write_pos/8][write_pos%8].get()) NullButton();
-      i += 1;
+  return true;
+}
+/**
+ * Mask of the chord shapes the buttons of every register use.
+ */
+uint16_t Keyboard::chordShapes() {
+  return ChordShapes::usedBy(maps, KEYBOARD_REGISTERS * buttonCount());
+}
+/**
+ * Mask of the chord shapes the layout being received uses so far.
+ */
+uint16_t Keyboard::editedChordShapes() {
+  return editor ? ChordShapes::usedBy(edit_buttons, editor->buttonCount())
+                : 0;
+}
+/**
+ * Write the expression targets as they are sent after the buttons (see
+ * LayoutDecoder) to buf, 1 + 2*MAX_EXPRESSION_TARGETS bytes at most.
+ * Return the number of bytes written.
+ */
+uint8_t Keyboard::expressionToBytes(byte* buf) {
+  uint8_t size = 1;
+  buf[0] = 0;
+  for(uint8_t i=0; i<MAX_EXPRESSION_TARGETS; i++) {
+    if(expression[i].channel) {
+      buf[size++] = expression[i].channel;
+      buf[size++] = expression[i].offset + 64;
+      buf[0]++;
     }
   }
-  if(write_pos == 81) { // End of keyboard
-    read_buttons = false;
+  return size;
+}
+/**
+ * CRC of the layout as it is sent: the name, a 0x00, the SysEx record of
+ * each button, then the expression targets. The editor can compare it with
+ * its own copy instead of asking for the whole layout.
+ */
+uint16_t Keyboard::checksum() {
+  uint16_t crc = CRC16_INIT;
+  for(const unsigned char *c=name; *c; c++)
+    crc = crc16_update(crc, *c);
+  crc = crc16_update(crc, 0x00);
+  for(uint8_t i=0; i<buttonCount(); i++) {
+    byte record[MAX_BUTTON_RECORD];
+    const uint8_t len = keyboard[i].toBytes(record);
+    for(uint8_t j=0; j<len; j++)
+      crc = crc16_update(crc, record[j]);
   }
-  return i;
+  byte targets[1 + 2*MAX_EXPRESSION_TARGETS];
+  const uint8_t len = expressionToBytes(targets);
+  for(uint8_t j=0; j<len; j++)
+    crc = crc16_update(crc, targets[j]);
+  return crc;
 }
-void RightKeyboard::send() {
-  const size_t size = 100;
-  byte data[size] = {0xF0, 0x7D, 0x02};
-  data[3] = type();
-  byte *write = data + 4;
+/**
+ * Send the layout as one SysEx, written to the MIDI output as it is
+ * encoded, a few bytes at a time. With packed, the name is sent packed
+ * (see LayoutDecoder) instead of base64: 8/7 of its size instead of 4/3.
+ */
+void Keyboard::send(bool packed) {
+  byte bytes[8] = {0xF0, 0x7D, 0x02, type()};
+  midi_out.writeSysEx(bytes, 4);
 
   // Send name
 
-  unsigned char *name = this->name;
-  size_t name_len = strlen((const char*)name);
-  pad = 0;
-  while(name_len > 0)
-  {
-    size_t max_encodable = (size-(write-data)-1)*3/4;
-    size_t send_len = min(name_len, max_encodable);
-    write += encode_base64(name, send_len, write);
-    name += send_len;
-    name_len -= send_len;
-    if(write - data == size) // The buffer is full
-    {
-      MIDI.sendSysEx(size, data, true);
-      pad = 0;
-      write = data;
-    }
-    else if(name_len > 0)
-    {
-      // We didn't sent the whole name, but the buffer isn't full
-      send_len = max(name_len, (size_t)3);
-      encode_base64(name, send_len, temp_bytes);
-      memcpy(write, temp_bytes, size - (write - data));
-      pad =  4 - (size - (write - data));
-      // Now the buffer is full
-      MIDI.sendSysEx(size, data, true);
-      name += send_len;
-      name_len -= send_len;
-      // Write what's remaining
-      memcpy(data, temp_bytes+pad, 4-pad);
-      write = data + 4-pad;
+  const uint8_t name_len = strlen((const char*)name);
+  if(packed) {
+    bytes[0] = 0x01;
+    bytes[1] = name_len;
+    midi_out.writeSysEx(bytes, 2);
+    for(uint8_t i=0; i<name_len; i+=7) {
+      const uint8_t len = min(7, name_len - i);
+      bytes[0] = 0x00;
+      for(uint8_t j=0; j<len; j++) {
+        bytes[0] |= (name[i+j] >> 7) << j;
+        bytes[1+j] = name[i+j] & 0x7F;
+      }
+      midi_out.writeSysEx(bytes, 1 + len);
     }
   }
-  write[0] = 0x00;
-  write++;
+  else {
+    // One base64 quartet at a time (and its null terminator)
+    for(uint8_t i=0; i<name_len; i+=3)
+      midi_out.writeSysEx(bytes, encode_base64(name+i, min(3, name_len-i),
+                                               bytes));
+  }
+  bytes[0] = 0x00;
+  midi_out.writeSysEx(bytes, 1);
 
   // Send buttons
 
-  for(size_t i=0; i<81; i++)
-  {
-    uint8_t button_len = keyboard[i/8][i%8]->toBytes(nullptr);
-    size_t remaining = size - (write - data);
-    if(button_len <= remaining)
-    {
-      write += keyboard[i/8][i%8]->toBytes(write);
-      if(button_len == remaining) // The buffer is full
-      {
-        MIDI.sendSysEx(size, data, true);
-        pad = 0;
-        write = data;
-      }
-    }
-    else if(button_len > remaining)
-    {
-      // buffer is not full but button don't fit
-      pad = button_len - remaining;
-      keyboard[i/8][i%8]->toBytes(temp_bytes);
-      memcpy(write, temp_bytes, remaining);
-      // Now the buffer is full
-      MIDI.sendSysEx(size, data, true);
-      // Write what's remaining
-      memcpy(data, temp_bytes+remaining, pad);
-      write = data + pad;
+  for(uint8_t i=0; i<buttonCount(); i++)
+    midi_out.writeSysEx(bytes, keyboard[i].toBytes(bytes));
+  byte targets[1 + 2*MAX_EXPRESSION_TARGETS];
+  midi_out.writeSysEx(targets, expressionToBytes(targets));
+  bytes[0] = 0xF7;
+  midi_out.writeSysEx(bytes, 1);
+}
+
+/**
+ * Apply a layout SysEx stored in PROGMEM, decoding it from flash a byte at
+ * a time, to every register.
+ */
+void Keyboard::applyDefault(const byte* layout, size_t size) {
+  decoder.begin(name, keyboard, buttonCount(), expression);
+  // Skip the header, 0xF0 0x7D 0x02 type
+  for(size_t i=4; i<size; i++)
+    decoder.feed(pgm_read_byte(layout + i));
+  decoder.clear();
+  // The other registers start as copies of it
+  for(uint8_t reg=0; reg<KEYBOARD_REGISTERS; reg++) {
+    if(registerMap(reg) != keyboard)
+      memcpy(registerMap(reg), keyboard, buttonCount() * sizeof(Button));
+  }
+}
+/**
+ * Send a layout SysEx stored in PROGMEM as the "from storage" (0x01)
+ * layout of this keyboard, copying it from flash to the MIDI output.
+ */
+void Keyboard::sendDefault(const byte* layout, size_t size) {
+  const byte header[4] = {0xF0, 0x7D, 0x01, type()};
+  midi_out.writeSysEx(header, sizeof(header));
+  for(size_t i=sizeof(header); i<size; i++) {
+    const byte value = pgm_read_byte(layout + i);
+    midi_out.writeSysEx(&value, 1);
+  }
+}
+
+/**
+ * Index of a key in the table, count if it isn't held.
+ */
+uint8_t HeldButtons::find(uint8_t key) const
+{
+  uint8_t i = 0;
+  while(i < count && keys[i] != key)
+    i++;
+  return i;
+}
+/**
+ * Remember the button of a key that was just pressed.
+ */
+void HeldButtons::press(uint8_t key, const Button &button)
+{
+  if(!releases(button))
+    return;
+  const uint8_t i = find(key);
+  if(i == count) {
+    if(count == MAX_HELD_BUTTONS)
+      return;
+    keys[count++] = key;
+  }
+  buttons[i] = button;
+}
+/**
+ * Forget a key that was released and give the button it was pressed with.
+ * Return false if the key wasn't remembered.
+ */
+bool HeldButtons::release(uint8_t key, Button &button)
+{
+  const uint8_t i = find(key);
+  if(i == count)
+    return false;
+  button = buttons[i];
+  // The last key takes its place
+  count--;
+  keys[i] = keys[count];
+  buttons[i] = buttons[count];
+  return true;
+}
+/**
+ * Mask of the chord shapes the keys held play.
+ */
+uint16_t HeldButtons::chordShapes() const
+{
+  return ChordShapes::usedBy(buttons, count);
+}
+
+/**
+ * Return true if one of the keys held plays the note on the channel (0 to
+ * 15).
+ */
+bool HeldButtons::plays(uint8_t channel, uint8_t note) const
+{
+  for(uint8_t i=0; i<count; i++) {
+    if((buttons[i].message[0] & 0x0F) != channel)
+      continue;
+    byte notes[MAX_CHORD_NOTES];
+    const uint8_t note_count = buttons[i].notes(notes);
+    for(uint8_t j=0; j<note_count; j++) {
+      if(notes[j] == note)
+        return true;
     }
   }
-  write[0] = 0xF7;
-  write++;
-  MIDI.sendSysEx(write - data, data, true);
+  return false;
+}
+/**
+ * Return true if the button does something on release.
+ */
+bool HeldButtons::releases(const Button &button)
+{
+  return button.type == NOTE_BUTTON || button.type == CHORD_BUTTON
+         || button.type == REGISTER_BUTTON;
 }
+
@@ -0,0 +1,95 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __MATRIX_H__
+#define __MATRIX_H__
+
+#include "hal.h"
+
+// Number of keys read for each group: 8 on the right keyboard (PINA), then
+// 8 on the left keyboard (PINC).
+#define MATRIX_COLUMNS 16
+#define RIGHT_COLUMN 0
+#define LEFT_COLUMN 8
+#define MATRIX_GROUP_BYTES (MATRIX_COLUMNS / 8)
+#define MATRIX_BYTES (GROUP_COUNT * MATRIX_GROUP_BYTES)
+#define MATRIX_WORDS ((MATRIX_BYTES + 3) / 4)
+// Maximum number of key changes reported by a single diff.
+#define MAX_KEY_EVENTS 16
+// Number of key changes KeyEventQueue can hold, must be a power of 2.
+#define KEY_EVENT_QUEUE_SIZE 32
+
+/**
+ * Up/down status of every key of the matrix, one bit per key, 1 if pressed.
+ * Group g starts at byte g*MATRIX_GROUP_BYTES. The matrix is compared a
+ * 32-bit word at a time; both the AVR and the host are little endian, so bit
+ * b of words[w] is bit b%8 of bytes[w*4 + b/8].
+ */
+union MatrixSnapshot
+{
+  uint8_t bytes[MATRIX_WORDS * 4];
+  uint32_t words[MATRIX_WORDS];
+};
+
+/**
+ * A key that changed between two scans.
+ */
+struct KeyEvent
+{
+  uint8_t group;
+  uint8_t index;
+  uint8_t on;
+};
+
+/**
+ * Holds the last scanned matrix and the one before, and reports the keys
+ * that changed in between.
+ */
+class Matrix
+{
+  public:
+    Matrix();
+    void setKeys(uint8_t group, uint8_t column, byte value);
+    uint8_t diff(KeyEvent *events, uint8_t max_events);
+  private:
+    MatrixSnapshot current;
+    MatrixSnapshot previous;
+};
+
+/**
+ * Lock-free queue of key changes, filled by the scan interrupt and emptied
+ * by loop(). There must be a single producer and a single consumer: each
+ * index is only written by one side, and is a single byte, so it is read
+ * atomically by the other.
+ */
+class KeyEventQueue
+{
+  public:
+    KeyEventQueue() : head(0), tail(0)
+    {};
+    void pushChanges(Matrix &matrix);
+    bool pop(KeyEvent &event);
+  private:
+    KeyEvent events[KEY_EVENT_QUEUE_SIZE];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+};
+
+#endif //__MATRIX_H__
@@ -0,0 +1,98 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "matrix.h"
+
+Matrix::Matrix()
+{
+  memset(&current, 0, sizeof(current));
+  memset(&previous, 0, sizeof(previous));
+}
+
+/**
+ * Store the 8 keys read from column onward (a multiple of 8) in a group.
+ */
+void Matrix::setKeys(uint8_t group, uint8_t column, byte value)
+{
+  current.bytes[group * MATRIX_GROUP_BYTES + column / 8] = value;
+}
+
+/**
+ * Write the keys that changed since the last diff to events, at most
+ * max_events of them, and return how many were written.
+ * Keys that did not fit are kept for the next diff.
+ */
+uint8_t Matrix::diff(KeyEvent *events, uint8_t max_events)
+{
+  uint8_t count = 0;
+  for(uint8_t w=0; w<MATRIX_WORDS; w++) {
+    uint32_t changed = current.words[w] ^ previous.words[w];
+    // Only walk the bits that changed
+    while(changed) {
+      if(count == max_events)
+        return count;
+      const uint8_t bit = __builtin_ctzl(changed);
+      const uint32_t mask = (uint32_t)1 << bit;
+      const uint8_t pos = w * 4 + bit / 8;
+      events[count].group = pos / MATRIX_GROUP_BYTES;
+      events[count].index = (pos % MATRIX_GROUP_BYTES) * 8 + bit % 8;
+      events[count].on = (current.words[w] & mask) != 0;
+      count++;
+      previous.words[w] ^= mask;
+      changed &= changed - 1;
+    }
+  }
+  return count;
+}
+
+// Keep the compiler from moving memory accesses across the barrier
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+/**
+ * Producer side: push the keys that changed in the matrix. Changes that
+ * don't fit are kept in the matrix for the next call.
+ */
+void KeyEventQueue::pushChanges(Matrix &matrix)
+{
+  const uint8_t t = tail;
+  const uint8_t room = KEY_EVENT_QUEUE_SIZE - (uint8_t)(t - head);
+  KeyEvent changes[MAX_KEY_EVENTS];
+  const uint8_t count = matrix.diff(changes, min(room, MAX_KEY_EVENTS));
+  for(uint8_t i=0; i<count; i++)
+    events[(uint8_t)(t + i) & (KEY_EVENT_QUEUE_SIZE - 1)] = changes[i];
+  // Events must be written before they are published
+  COMPILER_BARRIER();
+  tail = t + count;
+}
+
+/**
+ * Consumer side: take the oldest key change. Return false if there is none.
+ */
+bool KeyEventQueue::pop(KeyEvent &event)
+{
+  const uint8_t h = head;
+  if(h == tail)
+    return false;
+  event = events[h & (KEY_EVENT_QUEUE_SIZE - 1)];
+  // The event must be read before its slot is given back
+  COMPILER_BARRIER();
+  head = h + 1;
+  return true;
+}
@@ -22,6 +22,9 @@
 #ifndef __MIDI_H__
 #define __MIDI_H__
 
+#include "hal.h"
+
+#ifdef ARDUINO
 #include <MIDI.h>
 struct MySettings : public midi::DefaultSettings
 {
@@ -31,6 +34,8 @@ struct MySettings : public midi::DefaultSettings
   //after starting up the Arduino because we miss the first CC byte.
   //Setting UseRunningStatus to false removes this "feature."
   //See https://github.com/projectgus/hairless-midiserial/issues/16 for details.
+  //Channel messages are not sent by the library but by MidiOut, which has
+  //its own safe running status mode (see RUNNING_STATUS).
   static const bool UseRunningStatus = false;
   // Set MIDI baud rate. MIDI has a default baud rate of 31250,
   // but we're setting our baud rate higher so that the Serial<->MIDI software 
@@ -42,6 +47,21 @@ struct MySettings : public midi::DefaultSettings
 #else
   MIDI_CREATE_CUSTOM_INSTANCE(HardwareSerial, Serial, MIDI, MySettings);
 #endif
+#else
+// Host simulation: messages are written to the simulated serial port.
+#ifdef BLUETOOTH
+  SimMidi MIDI(Serial1);
+#else
+  SimMidi MIDI(Serial);
+#endif
+#endif //ARDUINO
+
+// Port the MIDI messages go to, for the messages written without the library
+#ifdef BLUETOOTH
+  #define MIDI_SERIAL Serial1
+#else
+  #define MIDI_SERIAL Serial
+#endif
 
 const byte sysExDialog[] = {0x7d, 0x0F};
 
@@ -0,0 +1,152 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __MIDI_OUT_H__
+#define __MIDI_OUT_H__
+
+#include "hal.h"
+#include "midi.h"
+#ifdef STATS
+#include "stats.h"
+#endif
+#ifdef TRACE
+#include "trace.h"
+#endif
+
+// Number of messages each queue can hold, must be a power of 2.
+#define MIDI_QUEUE_SIZE 32
+// With RUNNING_STATUS, the status byte is sent again at least this often so
+// that a host started late gets in sync.
+#ifndef RUNNING_STATUS_REFRESH_MS
+#define RUNNING_STATUS_REFRESH_MS 100
+#endif
+
+/**
+ * A MIDI channel message in wire format. A status byte of 0 marks a
+ * message that was cancelled while waiting in the queue.
+ */
+struct MidiMessage
+{
+  uint8_t bytes[3];
+};
+
+/**
+ * The notes sounding on each channel, one bit per note, as sent to
+ * MidiOut: a note is on from its note-on until its note-off (or note-on of
+ * velocity 0) is sent. Also counts the notes sounding, the most that ever
+ * sounded together, and the note-offs of notes that weren't sounding.
+ */
+class ActiveNotes
+{
+  public:
+    ActiveNotes() : channels(0), sounding(0), peak(0), unmatched_offs(0)
+    {
+      memset(bits, 0, sizeof(bits));
+    };
+    void update(const byte *message);
+    bool isOn(uint8_t channel, uint8_t note) const
+    {
+      return bits[channel][note / 8] & (1 << (note % 8));
+    }
+    // Bit n set if channel n (0 to 15) has notes sounding
+    uint16_t channelMask() const { return channels; }
+    uint16_t count() const { return sounding; }
+    uint16_t peakCount() const { return peak; }
+    uint16_t unmatchedOffs() const { return unmatched_offs; }
+  private:
+    uint8_t bits[16][16];
+    uint16_t channels;
+    uint16_t sounding;
+    uint16_t peak;
+    uint16_t unmatched_offs;
+};
+
+/**
+ * Ring buffer of MIDI messages.
+ */
+class MidiQueue
+{
+  public:
+    MidiQueue() : head(0), tail(0)
+    {};
+    uint8_t count() const { return tail - head; }
+    bool isEmpty() const { return head == tail; }
+    bool isFull() const { return count() == MIDI_QUEUE_SIZE; }
+    void push(const byte *message);
+    MidiMessage &front() { return messages[head & (MIDI_QUEUE_SIZE - 1)]; }
+    void pop() { head++; }
+    bool cancelNoteOn(const byte *note_off);
+  private:
+    MidiMessage messages[MIDI_QUEUE_SIZE];
+    uint8_t head;
+    uint8_t tail;
+};
+
+/**
+ * Outgoing MIDI channel messages.
+ *
+ * The scan path queues messages with send() and never waits for the UART.
+ * drain() then writes them only as far as the serial TX buffer has room,
+ * note-offs first. A note-on still queued when the note-off of the same key
+ * comes in is cancelled along with the note-off.
+ *
+ * With RUNNING_STATUS, a message with the same status byte as the previous
+ * one is sent without it. The status byte is still sent on every channel or
+ * message type change, every RUNNING_STATUS_REFRESH_MS and after a SysEx,
+ * so a host that missed it is never out of sync for long.
+ * SysEx messages go through sendSysEx() or writeSysEx() so that running
+ * status is kept right.
+ *
+ * The notes sent are tracked, so that notesOff() can release exactly the
+ * notes still sounding.
+ */
+class MidiOut
+{
+  public:
+    MidiOut() : high_water_mark(0), running_status(0), running_status_time(0)
+    {};
+    void send(const byte *message);
+    void controlChange(uint8_t control, uint8_t value, uint8_t channel);
+    void pitchBend(int value, uint8_t channel);
+    void sendSysEx(unsigned length, const byte *data, bool boundaries);
+    void writeSysEx(const byte *data, uint8_t length);
+    void drain();
+    uint16_t notesOff(bool (*keep)(uint8_t channel, uint8_t note));
+    const ActiveNotes &activeNotes() const { return active_notes; }
+    void resetRunningStatus() { running_status = 0; }
+    bool isEmpty() const { return note_offs.isEmpty() && others.isEmpty(); }
+    uint8_t highWaterMark() const { return high_water_mark; }
+    void resetHighWaterMark() { high_water_mark = 0; }
+    static uint8_t length(const byte *message);
+  private:
+    bool writeFront(MidiQueue &queue, bool blocking);
+
+    MidiQueue note_offs;
+    MidiQueue others;
+    ActiveNotes active_notes;
+    uint8_t high_water_mark;
+    // Last status byte sent, 0 if none
+    byte running_status;
+    unsigned long running_status_time;
+};
+
+extern MidiOut midi_out;
+
+#endif //__MIDI_OUT_H__
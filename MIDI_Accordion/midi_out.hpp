@@ -0,0 +1,244 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "midi_out.h"
+
+MidiOut midi_out;
+
+/**
+ * Follow a channel message on its way out.
+ */
+void ActiveNotes::update(const byte *message)
+{
+  const byte type = message[0] & 0xF0;
+  if(type != 0x80 && type != 0x90)
+    return;
+  const uint8_t channel = message[0] & 0x0F;
+  byte &bits_byte = bits[channel][message[1] / 8];
+  const byte mask = 1 << (message[1] % 8);
+  if(type == 0x90 && message[2]) {
+    if(!(bits_byte & mask)) {
+      bits_byte |= mask;
+      channels |= 1U << channel;
+      if(++sounding > peak)
+        peak = sounding;
+    }
+  }
+  else if(bits_byte & mask) {
+    bits_byte &= ~mask;
+    sounding--;
+    byte any = 0;
+    for(uint8_t i=0; i<16; i++)
+      any |= bits[channel][i];
+    if(!any)
+      channels &= ~(1U << channel);
+  }
+  else {
+    unmatched_offs++;
+  }
+}
+
+void MidiQueue::push(const byte *message)
+{
+  memcpy(messages[tail & (MIDI_QUEUE_SIZE - 1)].bytes, message,
+         MidiOut::length(message));
+  tail++;
+}
+
+/**
+ * Cancel the last queued note-on of the note released by note_off.
+ * Return true if there was one.
+ */
+bool MidiQueue::cancelNoteOn(const byte *note_off)
+{
+  const byte note_on = note_off[0] + 0x10;
+  for(uint8_t i=tail; i!=head;) {
+    i--;
+    MidiMessage &message = messages[i & (MIDI_QUEUE_SIZE - 1)];
+    if(message.bytes[0] == note_on && message.bytes[1] == note_off[1]) {
+      message.bytes[0] = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Length of a channel message from its status byte.
+ */
+uint8_t MidiOut::length(const byte *message)
+{
+  const byte type = message[0] & 0xF0;
+  return (type == 0xC0 || type == 0xD0) ? 2 : 3;
+}
+
+/**
+ * Queue a channel message in wire format. If its queue is full, the oldest
+ * message is written even if the UART has to wait, so that nothing is lost.
+ */
+void MidiOut::send(const byte *message)
+{
+  active_notes.update(message);
+  #ifdef TRACE
+  trace.add(TRACE_MIDI_QUEUED, message[0], message[1]);
+  #endif
+  if((message[0] & 0xF0) == 0x80) {
+    // A note released before its note-on went out is never sent
+    if(others.cancelNoteOn(message))
+      return;
+    if(note_offs.isFull())
+      writeFront(note_offs, true);
+    note_offs.push(message);
+  }
+  else {
+    if(others.isFull())
+      writeFront(others, true);
+    others.push(message);
+  }
+  const uint8_t count = note_offs.count() + others.count();
+  if(count > high_water_mark)
+    high_water_mark = count;
+}
+
+/**
+ * Queue a control change. channel goes from 1 to 16, like in the MIDI library.
+ */
+void MidiOut::controlChange(uint8_t control, uint8_t value, uint8_t channel)
+{
+  const byte message[3] = {(byte)(0xB0 | ((channel - 1) & 0x0F)),
+                           (byte)(control & 0x7F), (byte)(value & 0x7F)};
+  send(message);
+}
+
+/**
+ * Queue a pitch bend, value going from -8192 to 8191.
+ * channel goes from 1 to 16, like in the MIDI library.
+ */
+void MidiOut::pitchBend(int value, uint8_t channel)
+{
+  const unsigned bend = value + 8192;
+  const byte message[3] = {(byte)(0xE0 | ((channel - 1) & 0x0F)),
+                           (byte)(bend & 0x7F), (byte)((bend >> 7) & 0x7F)};
+  send(message);
+}
+
+/**
+ * Queue a note-off for each note sounding, except those keep returns true
+ * for (keep may be null), and return how many were sent. Only the channels
+ * with notes sounding are looked at.
+ */
+uint16_t MidiOut::notesOff(bool (*keep)(uint8_t channel, uint8_t note))
+{
+  uint16_t count = 0;
+  for(uint8_t channel=0; channel<16; channel++) {
+    if(!(active_notes.channelMask() & (1U << channel)))
+      continue;
+    for(uint8_t note=0; note<128; note++) {
+      if(!active_notes.isOn(channel, note) || (keep && keep(channel, note)))
+        continue;
+      const byte note_off[3] = {(byte)(0x80 | channel), note, 0x40};
+      send(note_off);
+      count++;
+    }
+  }
+  return count;
+}
+
+/**
+ * Send a SysEx (or part of one) right away through the MIDI library.
+ * A SysEx cancels running status.
+ */
+void MidiOut::sendSysEx(unsigned length, const byte *data, bool boundaries)
+{
+  MIDI.sendSysEx(length, data, boundaries);
+  running_status = 0;
+  #ifdef STATS
+  stats.bytesSent(boundaries ? length : length + 2);
+  #endif
+}
+
+/**
+ * Write part of a SysEx, boundaries included, straight to the serial port,
+ * so that a long SysEx can be written as it is built without buffering it.
+ * Waits if the TX buffer is full.
+ */
+void MidiOut::writeSysEx(const byte *data, uint8_t length)
+{
+  MIDI_SERIAL.write(data, length);
+  running_status = 0;
+  #ifdef STATS
+  stats.bytesSent(length);
+  #endif
+}
+
+/**
+ * Write the queued messages, note-offs first, as long as they fit in the
+ * serial TX buffer.
+ */
+void MidiOut::drain()
+{
+  while(!note_offs.isEmpty()) {
+    if(!writeFront(note_offs, false))
+      return;
+  }
+  while(!others.isEmpty()) {
+    if(!writeFront(others, false))
+      return;
+  }
+}
+
+/**
+ * Write the oldest message of a queue and remove it. Unless blocking, give
+ * up and return false if the TX buffer can't take it right now.
+ */
+bool MidiOut::writeFront(MidiQueue &queue, bool blocking)
+{
+  const MidiMessage &message = queue.front();
+  if(message.bytes[0]) { // Not cancelled
+    uint8_t len = length(message.bytes);
+    const byte *bytes = message.bytes;
+    #ifdef RUNNING_STATUS
+    const unsigned long now = millis();
+    if(bytes[0] == running_status
+       && now - running_status_time < RUNNING_STATUS_REFRESH_MS) {
+      bytes++;
+      len--;
+    }
+    #endif //RUNNING_STATUS
+    if(!blocking && MIDI_SERIAL.availableForWrite() < len)
+      return false;
+    #ifdef STATS
+    stats.firstByte();
+    stats.bytesSent(len);
+    #endif
+    MIDI_SERIAL.write(bytes, len);
+    #ifdef TRACE
+    trace.add(TRACE_MIDI_SENT, message.bytes[0], message.bytes[1]);
+    #endif
+    #ifdef RUNNING_STATUS
+    if(bytes == message.bytes) {
+      running_status = bytes[0];
+      running_status_time = now;
+    }
+    #endif //RUNNING_STATUS
+  }
+  queue.pop();
+  return true;
+}
@@ -0,0 +1,97 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __PRESETS_H__
+#define __PRESETS_H__
+
+#include "hal.h"
+#include "keyboard.h"
+
+// Number of preset slots of each keyboard.
+#define PRESET_SLOTS 4
+// Active slot of a keyboard with no preset.
+#define PRESET_NONE 0xFF
+
+/*
+ * EEPROM layout:
+ *   0: PRESET_MAGIC, PRESET_VERSION
+ *   2: active slot of the right keyboard, then of the left keyboard
+ *   4: number of chord shapes, then the CHORD_SHAPES shapes
+ *   PRESET_SLOTS_ADDRESS: PRESET_SLOTS slots of the right keyboard, then of
+ *      the left keyboard
+ * A slot is a PRESET_USED byte, the name, the buttons then the expression
+ * targets as they are in RAM, so that loading a preset is a plain copy.
+ * The chord buttons refer to the chord shapes by index, the shapes are
+ * saved along with each preset, and the shapes a preset uses are never
+ * freed (see ChordShapes).
+ */
+#define PRESET_MAGIC 0x41
+// Change it when the slot format changes, the presets are then forgotten.
+#define PRESET_VERSION 3
+#define PRESET_USED 0x01
+#define PRESET_HEADER_SIZE 4
+#define PRESET_SHAPES_ADDRESS PRESET_HEADER_SIZE
+#define PRESET_SLOTS_ADDRESS (PRESET_SHAPES_ADDRESS + 1 \
+                              + CHORD_SHAPES*sizeof(ChordShape))
+#define PRESET_SLOT_SIZE (1 + MAX_NAME_LENGTH + MAX_KEYBOARD_BUTTONS*sizeof(Button) \
+                          + MAX_EXPRESSION_TARGETS*sizeof(ExpressionTarget))
+// Offset of the expression targets in a slot
+#define PRESET_EXPRESSION (1 + MAX_NAME_LENGTH + MAX_KEYBOARD_BUTTONS*sizeof(Button))
+
+static_assert(PRESET_SLOTS_ADDRESS + 2 * PRESET_SLOTS * PRESET_SLOT_SIZE
+              <= EEPROM_SIZE, "The presets don't fit in the EEPROM");
+
+/**
+ * Layout presets stored in EEPROM, PRESET_SLOTS for each keyboard.
+ *
+ * Loading a preset copies it over the keyboard in one go, without decoding
+ * anything, so that it can be done from a button while playing. The last
+ * preset loaded or saved of each keyboard is restored at boot. The active
+ * slots are kept in RAM: switching presets while playing doesn't write the
+ * EEPROM, flush() does it later.
+ */
+class PresetBank
+{
+  public:
+    void begin();
+    bool save(Keyboard &keyboard, uint8_t slot);
+    bool load(Keyboard &keyboard, uint8_t slot);
+    bool restore(Keyboard &keyboard);
+    bool isUsed(Keyboard &keyboard, uint8_t slot);
+    bool readName(Keyboard &keyboard, uint8_t slot, unsigned char *name);
+    uint8_t active(Keyboard &keyboard);
+    void flush();
+    // Mask of the chord shapes the presets use
+    uint16_t chordShapes() const { return chord_shapes_used; }
+  private:
+    void setActive(Keyboard &keyboard, uint8_t slot);
+    void readChordShapes();
+    static unsigned int slotAddress(Keyboard &keyboard, uint8_t slot);
+    static unsigned int slotAddress(uint8_t keyboard, uint8_t slot);
+
+    // Active slot of each keyboard, and the one the EEPROM holds
+    uint8_t active_slots[2];
+    uint8_t stored_slots[2];
+    uint16_t chord_shapes_used;
+};
+
+extern PresetBank presets;
+
+#endif //__PRESETS_H__
@@ -0,0 +1,204 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "presets.h"
+
+PresetBank presets;
+
+/**
+ * Read the chord shapes the presets use, or forget every preset if the
+ * EEPROM doesn't hold presets of this version. Only the header, the number
+ * of shapes and the used bytes are written. Must be called before any
+ * layout is applied, so that their chord shapes are added after these.
+ */
+void PresetBank::begin()
+{
+  byte header[PRESET_HEADER_SIZE];
+  hal_eeprom_read(0, header, sizeof(header));
+  if(header[0] == PRESET_MAGIC && header[1] == PRESET_VERSION) {
+    for(uint8_t i=0; i<2; i++) {
+      active_slots[i] = header[2 + i] < PRESET_SLOTS ? header[2 + i]
+                                                     : PRESET_NONE;
+      stored_slots[i] = header[2 + i];
+    }
+    hal_eeprom_read(PRESET_SHAPES_ADDRESS, &chord_shapes.count, 1);
+    chord_shapes.count = min(chord_shapes.count, (uint8_t)CHORD_SHAPES);
+    hal_eeprom_read(PRESET_SHAPES_ADDRESS + 1, chord_shapes.shapes,
+                    chord_shapes.count * sizeof(ChordShape));
+    readChordShapes();
+    chord_shapes.keep(chord_shapes_used);
+    return;
+  }
+  const byte unused = 0xFF;
+  for(uint8_t i=0; i<2*PRESET_SLOTS; i++)
+    hal_eeprom_write(PRESET_SLOTS_ADDRESS + i * PRESET_SLOT_SIZE, &unused, 1);
+  const byte no_shapes = 0;
+  hal_eeprom_write(PRESET_SHAPES_ADDRESS, &no_shapes, 1);
+  const byte empty_header[PRESET_HEADER_SIZE] =
+    {PRESET_MAGIC, PRESET_VERSION, PRESET_NONE, PRESET_NONE};
+  hal_eeprom_write(0, empty_header, sizeof(empty_header));
+  for(uint8_t i=0; i<2; i++)
+    active_slots[i] = stored_slots[i] = PRESET_NONE;
+  chord_shapes_used = 0;
+}
+
+/**
+ * Save the layout of a keyboard to a slot, which becomes the active one.
+ * This writes the EEPROM right away.
+ */
+bool PresetBank::save(Keyboard &keyboard, uint8_t slot)
+{
+  if(slot >= PRESET_SLOTS)
+    return false;
+  const unsigned int address = slotAddress(keyboard, slot);
+  const byte used = PRESET_USED;
+  // Shapes are only ever added, the shapes of the other presets are kept
+  hal_eeprom_write(PRESET_SHAPES_ADDRESS + 1, chord_shapes.shapes,
+                   chord_shapes.count * sizeof(ChordShape));
+  hal_eeprom_write(PRESET_SHAPES_ADDRESS, &chord_shapes.count, 1);
+  hal_eeprom_write(address + 1, keyboard.name, MAX_NAME_LENGTH);
+  hal_eeprom_write(address + 1 + MAX_NAME_LENGTH, keyboard.keyboard,
+                   keyboard.buttonCount() * sizeof(Button));
+  hal_eeprom_write(address + PRESET_EXPRESSION, keyboard.expression,
+                   sizeof(keyboard.expression));
+  // Marked used last, so that a slot cut by a reset is not loaded
+  hal_eeprom_write(address, &used, 1);
+  setActive(keyboard, slot);
+  flush();
+  readChordShapes();
+  return true;
+}
+
+/**
+ * Replace the layout of a keyboard with a preset, which becomes the active
+ * one. Return false if the slot is empty.
+ */
+bool PresetBank::load(Keyboard &keyboard, uint8_t slot)
+{
+  if(!isUsed(keyboard, slot))
+    return false;
+  const unsigned int address = slotAddress(keyboard, slot);
+  hal_eeprom_read(address + 1, keyboard.name, MAX_NAME_LENGTH);
+  keyboard.name[MAX_NAME_LENGTH - 1] = '\0';
+  hal_eeprom_read(address + 1 + MAX_NAME_LENGTH, keyboard.keyboard,
+                  keyboard.buttonCount() * sizeof(Button));
+  hal_eeprom_read(address + PRESET_EXPRESSION, keyboard.expression,
+                  sizeof(keyboard.expression));
+  setActive(keyboard, slot);
+  return true;
+}
+
+/**
+ * Load the active preset of a keyboard, if it has one.
+ */
+bool PresetBank::restore(Keyboard &keyboard)
+{
+  return load(keyboard, active(keyboard));
+}
+
+bool PresetBank::isUsed(Keyboard &keyboard, uint8_t slot)
+{
+  if(slot >= PRESET_SLOTS)
+    return false;
+  byte used;
+  hal_eeprom_read(slotAddress(keyboard, slot), &used, 1);
+  return used == PRESET_USED;
+}
+
+/**
+ * Read the name of a preset, MAX_NAME_LENGTH bytes. Return false if the
+ * slot is empty.
+ */
+bool PresetBank::readName(Keyboard &keyboard, uint8_t slot,
+                          unsigned char *name)
+{
+  if(!isUsed(keyboard, slot))
+    return false;
+  hal_eeprom_read(slotAddress(keyboard, slot) + 1, name, MAX_NAME_LENGTH);
+  name[MAX_NAME_LENGTH - 1] = '\0';
+  return true;
+}
+
+/**
+ * Slot of the last preset of a keyboard loaded or saved, PRESET_NONE if
+ * there is none.
+ */
+uint8_t PresetBank::active(Keyboard &keyboard)
+{
+  return active_slots[keyboard.type() - 1];
+}
+
+/**
+ * Write the active slots that changed to the EEPROM. It blocks for 3.3 ms
+ * per slot written, call it when nothing is playing.
+ */
+void PresetBank::flush()
+{
+  for(uint8_t i=0; i<2; i++) {
+    if(active_slots[i] != stored_slots[i]) {
+      hal_eeprom_write(2 + i, &active_slots[i], 1);
+      stored_slots[i] = active_slots[i];
+    }
+  }
+}
+
+void PresetBank::setActive(Keyboard &keyboard, uint8_t slot)
+{
+  active_slots[keyboard.type() - 1] = slot;
+}
+
+/**
+ * Find the chord shapes the buttons of the used slots refer to. Whole slots
+ * are read: stale bytes past the last button of a keyboard can only keep a
+ * shape that could have been freed.
+ */
+void PresetBank::readChordShapes()
+{
+  chord_shapes_used = 0;
+  for(uint8_t keyboard=0; keyboard<2; keyboard++) {
+    for(uint8_t slot=0; slot<PRESET_SLOTS; slot++) {
+      const unsigned int address = slotAddress(keyboard, slot);
+      byte used;
+      hal_eeprom_read(address, &used, 1);
+      if(used != PRESET_USED)
+        continue;
+      for(uint8_t i=0; i<MAX_KEYBOARD_BUTTONS; i++) {
+        Button button;
+        hal_eeprom_read(address + 1 + MAX_NAME_LENGTH + i * sizeof(Button),
+                        &button, sizeof(Button));
+        chord_shapes_used |= ChordShapes::usedBy(&button, 1);
+      }
+    }
+  }
+}
+
+unsigned int PresetBank::slotAddress(Keyboard &keyboard, uint8_t slot)
+{
+  return slotAddress(keyboard.type() - 1, slot);
+}
+
+/**
+ * Address of a slot of the right (0) or left (1) keyboard.
+ */
+unsigned int PresetBank::slotAddress(uint8_t keyboard, uint8_t slot)
+{
+  return PRESET_SLOTS_ADDRESS
+         + (keyboard * PRESET_SLOTS + slot) * PRESET_SLOT_SIZE;
+}
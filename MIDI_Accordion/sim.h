@@ -0,0 +1,516 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __SIM_H__
+#define __SIM_H__
+
+/*
+ * Host simulation of the parts of the Arduino core and of the MIDI library
+ * used by the firmware. Only included by hal.h when ARDUINO is not defined.
+ *
+ * The simulated board has:
+ *  - a simulated clock (sim_micros), only advanced by delays or by the
+ *    simulation driver, so that runs are reproducible;
+ *  - a key matrix (sim_right_matrix, sim_left_matrix) that a driver scripts,
+ *    and that is read back through PINA/PINC according to the driven pins;
+ *  - an EEPROM (sim_eeprom), erased at start;
+ *  - a BMP180 pressure sensor on I2C (sim_bmp180), read through Wire;
+ *  - a Serial port sending at 115200 baud and recording everything written
+ *    to it (sim_tx), which is where the mock MIDI instance writes its
+ *    messages.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define PROGMEM
+#define memcpy_P memcpy
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+/*
+ * Clock
+ */
+unsigned long sim_micros = 0;
+
+inline unsigned long micros() { return sim_micros; }
+inline unsigned long millis() { return sim_micros / 1000; }
+inline void delayMicroseconds(unsigned int us) { sim_micros += us; }
+inline void delay(unsigned long ms) { sim_micros += ms * 1000; }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+/*
+ * Pins and key matrix
+ */
+#define SIM_GROUPS 12
+#define SIM_FIRST_GROUP_PIN 38
+
+// Output ports of the group pins
+volatile uint8_t PORTD, PORTG, PORTL;
+// Keys pressed in each group, 1 if pressed. Written by the simulation driver.
+uint8_t sim_right_matrix[SIM_GROUPS];
+uint8_t sim_left_matrix[SIM_GROUPS];
+// Number of digitalWrite calls, to compare the matrix drivers.
+unsigned long sim_digital_writes = 0;
+
+/**
+ * Port register holding a group pin, as wired on the Mega (D38 is PD7,
+ * D39-D41 are PG2-PG0, D42-D49 are PL7-PL0).
+ */
+inline volatile uint8_t *sim_group_port(uint8_t group, uint8_t *mask)
+{
+  const uint8_t pin = SIM_FIRST_GROUP_PIN + group;
+  if(pin == 38) {
+    *mask = 1 << 7;
+    return &PORTD;
+  }
+  if(pin <= 41) {
+    *mask = 1 << (41 - pin);
+    return &PORTG;
+  }
+  *mask = 1 << (49 - pin);
+  return &PORTL;
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+inline void digitalWrite(uint8_t pin, uint8_t value)
+{
+  sim_digital_writes++;
+  if(pin < SIM_FIRST_GROUP_PIN || pin >= SIM_FIRST_GROUP_PIN + SIM_GROUPS)
+    return;
+  uint8_t mask;
+  volatile uint8_t *port = sim_group_port(pin - SIM_FIRST_GROUP_PIN, &mask);
+  if(value)
+    *port |= mask;
+  else
+    *port &= ~mask;
+}
+
+// First analog pin of the Mega, and level of each analog input (0 to 1023),
+// written by the simulation driver.
+#define A0 54
+int sim_analog[16] = {512, 512, 512, 512, 512, 512, 512, 512,
+                      512, 512, 512, 512, 512, 512, 512, 512};
+inline int analogRead(uint8_t pin) { return sim_analog[(pin - A0) & 15]; }
+
+/**
+ * Value seen on an input port: the OR of the keys of every driven group.
+ */
+inline uint8_t sim_read_port(const uint8_t *matrix)
+{
+  uint8_t value = 0;
+  for(uint8_t group=0; group<SIM_GROUPS; group++) {
+    uint8_t mask;
+    if(*sim_group_port(group, &mask) & mask)
+      value |= matrix[group];
+  }
+  return value;
+}
+#define PINA sim_read_port(sim_right_matrix)
+#define PINC sim_read_port(sim_left_matrix)
+
+/*
+ * EEPROM
+ */
+// Last EEPROM address of the Mega
+#define E2END 0xFFF
+
+/**
+ * EEPROM contents, erased (0xFF) at start like a new board.
+ */
+struct SimEeprom
+{
+  SimEeprom() { memset(bytes, 0xFF, sizeof(bytes)); }
+  uint8_t bytes[E2END + 1];
+};
+SimEeprom sim_eeprom;
+// Number of bytes actually written, eeprom_update_* skips unchanged ones.
+unsigned long sim_eeprom_writes = 0;
+
+inline void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+  memcpy(dst, sim_eeprom.bytes + (size_t)src, n);
+}
+inline void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+  for(size_t i=0; i<n; i++) {
+    uint8_t &cell = sim_eeprom.bytes[(size_t)dst + i];
+    if(cell != ((const uint8_t *)src)[i]) {
+      cell = ((const uint8_t *)src)[i];
+      sim_eeprom_writes++;
+    }
+  }
+}
+
+/*
+ * I2C bus, with a BMP180 pressure sensor on it
+ */
+#define SIM_BMP180_ADDRESS 0x77
+
+/**
+ * BMP180 answering with the example values of its datasheet: calibration
+ * and raw readings (ut, up) giving 15.0 °C and 69964 Pa with oss = 0.
+ * The driver changes up to move the bellows. Conversions are ready at once.
+ */
+struct SimBmp180
+{
+  SimBmp180() : id(0x55), control(0), ut(27898), up(23843)
+  {
+    const int16_t values[11] = {408, -72, -14383, (int16_t)32741,
+                                (int16_t)32757, 23153, 6190, 4, -32768,
+                                -8711, 2868};
+    for(uint8_t i=0; i<11; i++) {
+      calibration[2*i] = (uint16_t)values[i] >> 8;
+      calibration[2*i + 1] = values[i] & 0xFF;
+    }
+  }
+  uint8_t calibration[22];
+  // Chip id, 0x58 for a BMP280 answering at the same address
+  uint8_t id;
+  // Last command written to the control register
+  uint8_t control;
+  uint16_t ut;
+  // Raw pressure, already shifted by 8 - oss
+  uint32_t up;
+};
+SimBmp180 sim_bmp180;
+
+/**
+ * Wire (I2C master) talking to sim_bmp180.
+ */
+class SimWire
+{
+  public:
+    void begin() {}
+    void setClock(unsigned long clock) { (void)clock; }
+    void beginTransmission(uint8_t address)
+    {
+      this->address = address;
+      written = 0;
+      transactions++;
+    }
+    size_t write(uint8_t value)
+    {
+      if(written == 0)
+        reg = value;
+      else if(reg == 0xF4)
+        sim_bmp180.control = value;
+      written++;
+      return 1;
+    }
+    uint8_t endTransmission(bool stop = true)
+    {
+      (void)stop;
+      return address == SIM_BMP180_ADDRESS ? 0 : 2;
+    }
+    uint8_t requestFrom(uint8_t address, uint8_t size)
+    {
+      if(address != SIM_BMP180_ADDRESS)
+        return 0;
+      const uint32_t result = sim_bmp180.control == 0x2E
+        ? (uint32_t)sim_bmp180.ut << 8
+        : sim_bmp180.up << (8 - (sim_bmp180.control >> 6));
+      for(uint8_t i=0; i<size; i++) {
+        const uint8_t r = reg + i;
+        if(r == 0xD0)
+          rx[i] = sim_bmp180.id;
+        else if(r >= 0xAA && r <= 0xBF)
+          rx[i] = sim_bmp180.calibration[r - 0xAA];
+        else if(r >= 0xF6 && r <= 0xF8)
+          rx[i] = result >> (8 * (0xF8 - r));
+        else
+          rx[i] = 0;
+      }
+      rx_len = size;
+      rx_pos = 0;
+      return size;
+    }
+    int read() { return rx_pos < rx_len ? rx[rx_pos++] : -1; }
+
+    // Number of transactions, to check that the sensor isn't polled.
+    unsigned long transactions = 0;
+  private:
+    uint8_t address = 0;
+    uint8_t reg = 0;
+    uint8_t written = 0;
+    uint8_t rx[32];
+    uint8_t rx_len = 0;
+    uint8_t rx_pos = 0;
+};
+
+SimWire Wire;
+
+/*
+ * Serial
+ */
+#define SIM_TX_SIZE 65536
+// Size of the TX buffer of HardwareSerial, minus one
+#define SIM_TX_BUFFER 63
+// Size of the RX buffer of HardwareSerial, which holds one byte less
+#define SERIAL_RX_BUFFER_SIZE 64
+#define SIM_RX_BUFFER (SERIAL_RX_BUFFER_SIZE - 1)
+// Time to send a byte at 115200 baud (10 bits)
+#define SIM_BYTE_US 87
+
+/**
+ * Serial port sending a byte every SIM_BYTE_US of simulated time. Writing
+ * to a full TX buffer waits (advances the clock) like HardwareSerial does.
+ * Bytes queued with sim_send() arrive one every SIM_BYTE_US as well, and
+ * are dropped (counted in rx_overruns) when the RX buffer is full.
+ */
+class SimSerial
+{
+  public:
+    void begin(unsigned long baud) { (void)baud; }
+    operator bool() const { return true; }
+    size_t write(uint8_t b)
+    {
+      update();
+      while(tx_pending >= SIM_TX_BUFFER) {
+        sim_micros += SIM_BYTE_US;
+        update();
+        if(sim_on_wait)
+          sim_on_wait();
+      }
+      tx_pending++;
+      sim_tx[tx_len % SIM_TX_SIZE] = b;
+      tx_len++;
+      return 1;
+    }
+    size_t write(const uint8_t *buf, size_t len)
+    {
+      for(size_t i=0; i<len; i++)
+        write(buf[i]);
+      return len;
+    }
+    int availableForWrite()
+    {
+      update();
+      return SIM_TX_BUFFER - tx_pending;
+    }
+    int available()
+    {
+      receive();
+      return rx_count;
+    }
+    int read()
+    {
+      receive();
+      if(!rx_count)
+        return -1;
+      const uint8_t b = rx_buffer[rx_head];
+      rx_head = (rx_head + 1) % SIM_RX_BUFFER;
+      rx_count--;
+      return b;
+    }
+    template<typename T> size_t print(const T &x) { (void)x; return 0; }
+    template<typename T> size_t println(const T &x) { (void)x; return 0; }
+
+    // Everything written, modulo SIM_TX_SIZE.
+    uint8_t sim_tx[SIM_TX_SIZE];
+    // Total number of bytes written.
+    unsigned long tx_len = 0;
+    // Bytes waiting in the TX buffer.
+    unsigned long tx_pending = 0;
+    // Called for every byte time a write waits, as an interrupt would run
+    // meanwhile.
+    void (*sim_on_wait)() = nullptr;
+
+    /**
+     * Send bytes to the firmware, after the ones still on the line.
+     */
+    void sim_send(const uint8_t *data, size_t len)
+    {
+      receive();
+      if(line_head == line_tail)
+        line_time = sim_micros;
+      for(size_t i=0; i<len; i++)
+        line[line_tail++ % SIM_TX_SIZE] = data[i];
+    }
+    // Bytes received while the RX buffer was full.
+    unsigned long rx_overruns = 0;
+  private:
+    // Remove the bytes sent since the last update from the TX buffer
+    void update()
+    {
+      const unsigned long sent = (sim_micros - tx_time) / SIM_BYTE_US;
+      tx_pending = tx_pending > sent ? tx_pending - sent : 0;
+      tx_time += sent * SIM_BYTE_US;
+      if(!tx_pending)
+        tx_time = sim_micros;
+    }
+
+    // Move the bytes arrived since the last call to the RX buffer
+    void receive()
+    {
+      while(line_head != line_tail && sim_micros - line_time >= SIM_BYTE_US) {
+        line_time += SIM_BYTE_US;
+        const uint8_t b = line[line_head++ % SIM_TX_SIZE];
+        if(rx_count == SIM_RX_BUFFER) {
+          rx_overruns++;
+          continue;
+        }
+        rx_buffer[(rx_head + rx_count) % SIM_RX_BUFFER] = b;
+        rx_count++;
+      }
+    }
+
+    unsigned long tx_time = 0;
+    // Bytes sent by sim_send() not arrived yet, the first one being sent
+    // since line_time
+    uint8_t line[SIM_TX_SIZE];
+    unsigned long line_head = 0;
+    unsigned long line_tail = 0;
+    unsigned long line_time = 0;
+    uint8_t rx_buffer[SIM_RX_BUFFER];
+    uint8_t rx_head = 0;
+    uint8_t rx_count = 0;
+};
+
+SimSerial Serial;
+SimSerial Serial1;
+
+/*
+ * MIDI library
+ */
+// Size of the SysEx buffer of the library (DefaultSettings::SysExMaxSize)
+#define SIM_SYSEX_SIZE 128
+class SimMidi
+{
+  public:
+    SimMidi(SimSerial &port) : port(port) {}
+    void begin() {}
+    /**
+     * Parse one byte from the port. Only SysEx messages are handled, split
+     * in chunks of SIM_SYSEX_SIZE bytes like the library does.
+     */
+    bool read()
+    {
+      const int b = port.read();
+      if(b < 0 || b >= 0xF8) // Real-time messages don't end a SysEx
+        return false;
+      if(b == 0xF0) {
+        sysex_size = 0;
+        in_sysex = true;
+      }
+      else if(!in_sysex || (b & 0x80 && b != 0xF7)) {
+        in_sysex = false;
+        return false;
+      }
+      sysex[sysex_size++] = b;
+      if(b == 0xF7) {
+        in_sysex = false;
+        receiveSysEx(sysex, sysex_size);
+        return true;
+      }
+      if(sysex_size == SIM_SYSEX_SIZE - 1) {
+        sysex[sysex_size++] = 0xF0;
+        receiveSysEx(sysex, sysex_size);
+        sysex_size = 0;
+        sysex[sysex_size++] = 0xF7;
+      }
+      return false;
+    }
+    void turnThruOff() {}
+    void setHandleSystemExclusive(void (*handler)(byte *data, unsigned size))
+    {
+      sysex_handler = handler;
+    }
+    void sendNoteOn(uint8_t note, uint8_t velocity, uint8_t channel)
+    {
+      send(0x90, note, velocity, channel);
+    }
+    void sendNoteOff(uint8_t note, uint8_t velocity, uint8_t channel)
+    {
+      send(0x80, note, velocity, channel);
+    }
+    void sendControlChange(uint8_t control, uint8_t value, uint8_t channel)
+    {
+      send(0xB0, control, value, channel);
+    }
+    void sendProgramChange(uint8_t program, uint8_t channel)
+    {
+      if(channel == 0 || channel > 16)
+        return;
+      port.write(0xC0 | ((channel - 1) & 0x0F));
+      port.write(program & 0x7F);
+      messages++;
+    }
+    void sendPitchBend(int value, uint8_t channel)
+    {
+      const unsigned bend = unsigned(value + 8192);
+      send(0xE0, bend & 0x7F, (bend >> 7) & 0x7F, channel);
+    }
+    void sendSysEx(unsigned length, const byte *data,
+                   bool containsBoundaries = false)
+    {
+      if(!containsBoundaries)
+        port.write(0xF0);
+      port.write(data, length);
+      if(!containsBoundaries)
+        port.write(0xF7);
+      messages++;
+    }
+
+    /**
+     * Deliver a SysEx chunk to the firmware, as the library would do from
+     * read().
+     */
+    void receiveSysEx(byte *data, unsigned size)
+    {
+      if(sysex_handler)
+        sysex_handler(data, size);
+    }
+
+    // Number of messages sent.
+    unsigned long messages = 0;
+  private:
+    void send(uint8_t type, uint8_t data1, uint8_t data2, uint8_t channel)
+    {
+      // Same behavior as the library: channel 0 (omni) and off are not sent
+      if(channel == 0 || channel > 16)
+        return;
+      port.write(type | ((channel - 1) & 0x0F));
+      port.write(data1 & 0x7F);
+      port.write(data2 & 0x7F);
+      messages++;
+    }
+
+    SimSerial &port;
+    byte sysex[SIM_SYSEX_SIZE];
+    unsigned sysex_size = 0;
+    bool in_sysex = false;
+    void (*sysex_handler)(byte *data, unsigned size) = nullptr;
+};
+
+#endif //__SIM_H__
@@ -0,0 +1,106 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "hal.h"
+
+// The edge to MIDI latency histogram has STATS_BUCKETS buckets: bucket n
+// counts latencies under STATS_FIRST_BUCKET_US << n, the last one the rest.
+#define STATS_BUCKETS 8
+#define STATS_FIRST_BUCKET_US 128
+// Size of the report written by Stats::report().
+#define STATS_REPORT_BYTES 66
+
+/**
+ * Timing counters, compiled in with STATS and sent by the 0x0C SysEx.
+ *
+ * The scan path only adds a few operations per scan: scanDone() takes the
+ * time once per full scan, and the latency of a key edge is measured for
+ * the first edge waiting, from the scan that found it to the first MIDI
+ * byte written after it, without timestamping every message.
+ * Times are in microseconds, counters saturate instead of wrapping.
+ * With TIMER_SCAN, scanDone() is called by the scan interrupt, and only
+ * the scan counters are written there.
+ */
+class Stats
+{
+  public:
+    Stats()
+    {
+      reset();
+    };
+    void reset();
+    void scanDone(unsigned long now);
+    void edge();
+    void firstByte()
+    {
+      if(edge_pending)
+        latency(micros());
+    }
+    // Called when the MIDI output is empty: an edge still waiting sent
+    // nothing, it isn't measured
+    void outputEmpty() { edge_pending = false; }
+    void bytesSent(unsigned count) { bytes_sent += count; }
+    void sysExHandled(unsigned long us);
+    void midiRead(unsigned long us) { max16(midi_read_max, us); }
+    void sensorRead(unsigned long us) { max16(sensor_read_max, us); }
+    uint8_t report(byte *data);
+    static byte* put(byte *data, uint32_t value, uint8_t bytes);
+  private:
+    void latency(unsigned long now);
+    void countSecond(unsigned long now);
+    unsigned long lastScan() const;
+    static void max16(uint16_t &max_value, unsigned long value)
+    {
+      if(value > max_value)
+        max_value = min(value, 0xFFFFUL);
+    }
+
+    // Full scans: period min, max and sum, number of periods
+    unsigned long last_scan;
+    uint16_t scan_min;
+    uint16_t scan_max;
+    uint32_t scan_sum;
+    uint32_t scan_count;
+    // Edge to first MIDI byte
+    bool edge_pending;
+    unsigned long edge_time;
+    uint16_t histogram[STATS_BUCKETS];
+    // Key events of the second going on, of the last full second, and most
+    // in a second
+    unsigned long second_start;
+    uint16_t events;
+    uint16_t events_per_second;
+    uint16_t peak_events_per_second;
+    uint32_t bytes_sent;
+    // SysEx messages (chunks) handled, time spent in them and longest
+    uint16_t sysex_count;
+    uint32_t sysex_us;
+    uint16_t sysex_max;
+    // Longest MIDI.read() section of loop(), longest sensor read
+    uint16_t midi_read_max;
+    uint16_t sensor_read_max;
+};
+
+extern Stats stats;
+
+#endif //__STATS_H__
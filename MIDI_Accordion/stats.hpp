@@ -0,0 +1,172 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "stats.h"
+
+Stats stats;
+
+void Stats::reset()
+{
+  last_scan = 0;
+  scan_min = 0xFFFF;
+  scan_max = 0;
+  scan_sum = 0;
+  scan_count = 0;
+  edge_pending = false;
+  memset(histogram, 0, sizeof(histogram));
+  second_start = micros();
+  events = 0;
+  events_per_second = 0;
+  peak_events_per_second = 0;
+  bytes_sent = 0;
+  sysex_count = 0;
+  sysex_us = 0;
+  sysex_max = 0;
+  midi_read_max = 0;
+  sensor_read_max = 0;
+}
+
+/**
+ * Called at the end of each full scan of the matrix.
+ */
+void Stats::scanDone(unsigned long now)
+{
+  if(last_scan) {
+    const unsigned long period = now - last_scan;
+    if(period < scan_min)
+      scan_min = period;
+    max16(scan_max, period);
+    if(scan_sum <= 0xFFFFFFFFUL - period) {
+      scan_sum += period;
+      scan_count++;
+    }
+  }
+  last_scan = now;
+}
+
+unsigned long Stats::lastScan() const
+{
+  const uint8_t state = hal_disable_interrupts();
+  const unsigned long time = last_scan;
+  hal_restore_interrupts(state);
+  return time;
+}
+
+/**
+ * Close the second of key events going on if it is over. A second without
+ * any event closes late, it then counts as none.
+ */
+void Stats::countSecond(unsigned long now)
+{
+  const unsigned long elapsed = now - second_start;
+  if(elapsed < 1000000UL)
+    return;
+  events_per_second = elapsed < 2000000UL ? events : 0;
+  if(events_per_second > peak_events_per_second)
+    peak_events_per_second = events_per_second;
+  events = 0;
+  second_start = now;
+}
+
+/**
+ * Called for each key event, found by the last scan.
+ */
+void Stats::edge()
+{
+  const unsigned long scan_time = lastScan();
+  countSecond(scan_time);
+  if(events < 0xFFFF)
+    events++;
+  if(!edge_pending) {
+    edge_pending = true;
+    edge_time = scan_time;
+  }
+}
+
+void Stats::latency(unsigned long now)
+{
+  unsigned long us = now - edge_time;
+  uint8_t bucket = 0;
+  for(us /= STATS_FIRST_BUCKET_US; us && bucket < STATS_BUCKETS-1; us >>= 1)
+    bucket++;
+  if(histogram[bucket] < 0xFFFF)
+    histogram[bucket]++;
+  edge_pending = false;
+}
+
+void Stats::sysExHandled(unsigned long us)
+{
+  if(sysex_count < 0xFFFF)
+    sysex_count++;
+  if(sysex_us <= 0xFFFFFFFFUL - us)
+    sysex_us += us;
+  max16(sysex_max, us);
+}
+
+/**
+ * Write value to data as bytes 7-bit bytes, low bits first, and return
+ * where the next value goes.
+ */
+byte* Stats::put(byte *data, uint32_t value, uint8_t bytes)
+{
+  for(uint8_t i=0; i<bytes; i++) {
+    *data++ = value & 0x7F;
+    value >>= 7;
+  }
+  return data;
+}
+
+/**
+ * Write the counters to data, STATS_REPORT_BYTES 7-bit bytes, and return
+ * how many were written. 16-bit values take 3 bytes, 32-bit ones 5:
+ *   scan period min, average and max, number of scans (32-bit),
+ *   the STATS_BUCKETS latency buckets,
+ *   key events in the last second and most in a second,
+ *   MIDI bytes sent (32-bit),
+ *   SysEx chunks handled, total (32-bit) and longest time spent in them,
+ *   longest MIDI.read() section and longest sensor read.
+ */
+uint8_t Stats::report(byte *data)
+{
+  byte *p = data;
+  countSecond(micros());
+  // The scan counters are written by the scan interrupt with TIMER_SCAN
+  const uint8_t state = hal_disable_interrupts();
+  const uint16_t period_min = scan_count ? scan_min : 0;
+  const uint16_t period_max = scan_max;
+  const uint32_t sum = scan_sum;
+  const uint32_t count = scan_count;
+  hal_restore_interrupts(state);
+  p = put(p, period_min, 3);
+  p = put(p, count ? sum / count : 0, 3);
+  p = put(p, period_max, 3);
+  p = put(p, count, 5);
+  for(uint8_t i=0; i<STATS_BUCKETS; i++)
+    p = put(p, histogram[i], 3);
+  p = put(p, events_per_second, 3);
+  p = put(p, peak_events_per_second, 3);
+  p = put(p, bytes_sent, 5);
+  p = put(p, sysex_count, 3);
+  p = put(p, sysex_us, 5);
+  p = put(p, sysex_max, 3);
+  p = put(p, midi_read_max, 3);
+  p = put(p, sensor_read_max, 3);
+  return p - data;
+}
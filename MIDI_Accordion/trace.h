@@ -0,0 +1,93 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "hal.h"
+#include "matrix.h"
+
+// Number of records the trace keeps, 5 bytes of SRAM each.
+#ifndef TRACE_SIZE
+#define TRACE_SIZE 64
+#endif
+
+/**
+ * Kinds of trace records, and what their two data bytes hold.
+ */
+enum TraceKind : uint8_t
+{
+  TRACE_RAW_PRESS = 0x01,   // Key read pressed before debouncing: key
+  TRACE_RAW_RELEASE = 0x02, // Key read released before debouncing: key
+  TRACE_KEY_PRESS = 0x03,   // Debounced key press handled: key
+  TRACE_KEY_RELEASE = 0x04, // Debounced key release handled: key
+  TRACE_MIDI_QUEUED = 0x05, // Channel message queued: status, first data byte
+  TRACE_MIDI_SENT = 0x06,   // Channel message written: status, first data byte
+  TRACE_SYSEX = 0x07        // SysEx chunk received: first byte, size (255 max)
+};
+
+/**
+ * A trace record: the time since the previous record in microseconds
+ * (65535 if longer), the kind and two bytes of data. Keys are numbered
+ * like in HeldButtons: group * MATRIX_COLUMNS + column.
+ */
+struct TraceRecord
+{
+  uint16_t delta;
+  uint8_t kind;
+  uint8_t data[2];
+};
+
+/**
+ * Ring buffer of the last TRACE_SIZE events, compiled in with TRACE and
+ * dumped by the 0x0D SysEx, to see afterwards what happened around a missed
+ * or doubled note without changing the timing as printing would. The MIDI
+ * output is the same as without it.
+ *
+ * Records can be added from the scan interrupt and from loop(), they are
+ * added with interrupts disabled. Nothing is added while the trace is being
+ * sent, the records are counted as lost instead.
+ */
+class Trace
+{
+  public:
+    Trace() : head(0), count(0), lost(0), last_time(0), paused(false)
+    {
+      memset(raw, 0, sizeof(raw));
+    };
+    void add(uint8_t kind, uint8_t data0, uint8_t data1 = 0);
+    void rawKeys(uint8_t group, uint8_t column, byte value);
+    void send(bool clear);
+  private:
+    TraceRecord records[TRACE_SIZE];
+    // Index of the oldest record, number of records, records overwritten
+    // or not added while sending
+    uint8_t head;
+    uint8_t count;
+    uint16_t lost;
+    unsigned long last_time;
+    bool paused;
+    // Last raw reading of each group and column byte
+    byte raw[GROUP_COUNT][2];
+};
+
+extern Trace trace;
+
+#endif //__TRACE_H__
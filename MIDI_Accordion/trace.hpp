@@ -0,0 +1,116 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "trace.h"
+#include "midi_out.h"
+
+Trace trace;
+
+/**
+ * Add a record, overwriting the oldest one if the trace is full. While the
+ * trace is being sent the record is only counted as lost.
+ */
+void Trace::add(uint8_t kind, uint8_t data0, uint8_t data1)
+{
+  const uint8_t state = hal_disable_interrupts();
+  if(paused) {
+    if(lost < 0xFFFF)
+      lost++;
+  }
+  else {
+    const unsigned long now = micros();
+    TraceRecord &record = records[(uint8_t)(head + count) % TRACE_SIZE];
+    record.delta = min(now - last_time, 0xFFFFUL);
+    record.kind = kind;
+    record.data[0] = data0;
+    record.data[1] = data1;
+    last_time = now;
+    if(count < TRACE_SIZE)
+      count++;
+    else {
+      head = (head + 1) % TRACE_SIZE;
+      if(lost < 0xFFFF)
+        lost++;
+    }
+  }
+  hal_restore_interrupts(state);
+}
+
+/**
+ * Record the keys of a raw reading (8 keys from column onward) that
+ * changed since the last reading of the same keys.
+ */
+void Trace::rawKeys(uint8_t group, uint8_t column, byte value)
+{
+  byte &last = raw[group][column / 8];
+  byte changed = value ^ last;
+  last = value;
+  for(uint8_t bit=0; changed; bit++, changed >>= 1) {
+    if(changed & 1)
+      add(value & (1 << bit) ? TRACE_RAW_PRESS : TRACE_RAW_RELEASE,
+          group * MATRIX_COLUMNS + column + bit);
+  }
+}
+
+/**
+ * Send the trace as a 0x0D SysEx: the number of records, the number of
+ * records lost (overwritten, or added while the trace was being sent)
+ * since the trace was last cleared, 3 bytes each, 7 bits at a time low
+ * bits first, then the records from the oldest, each as a byte holding the
+ * high bits of its 5 bytes (bit 0 for the first one) then the 5 bytes
+ * without their high bit. A record is its delta, low byte first, kind,
+ * then data. With clear, the trace is emptied, the records lost while it
+ * was sent are reported by the next one.
+ */
+void Trace::send(bool clear)
+{
+  // Sending blocks on the UART, the scan interrupt still adds records
+  uint8_t state = hal_disable_interrupts();
+  paused = true;
+  const uint16_t sent_lost = lost;
+  hal_restore_interrupts(state);
+  byte bytes[8] = {0xF0, 0x7D, 0x0D,
+                   (byte)(count & 0x7F), (byte)(count >> 7), 0,
+                   (byte)(sent_lost & 0x7F), (byte)((sent_lost >> 7) & 0x7F)};
+  midi_out.writeSysEx(bytes, sizeof(bytes));
+  bytes[0] = (sent_lost >> 14) & 0x7F;
+  midi_out.writeSysEx(bytes, 1);
+  for(uint8_t i=0; i<count; i++) {
+    const TraceRecord &record = records[(uint8_t)(head + i) % TRACE_SIZE];
+    const byte raw_record[5] = {(byte)(record.delta & 0xFF),
+                                (byte)(record.delta >> 8), record.kind,
+                                record.data[0], record.data[1]};
+    bytes[0] = 0;
+    for(uint8_t j=0; j<5; j++) {
+      bytes[0] |= (raw_record[j] >> 7) << j;
+      bytes[1+j] = raw_record[j] & 0x7F;
+    }
+    midi_out.writeSysEx(bytes, 6);
+  }
+  bytes[0] = 0xF7;
+  midi_out.writeSysEx(bytes, 1);
+  state = hal_disable_interrupts();
+  if(clear) {
+    count = 0;
+    lost -= sent_lost;
+  }
+  paused = false;
+  hal_restore_interrupts(state);
+}
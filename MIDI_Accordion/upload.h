@@ -0,0 +1,94 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __UPLOAD_H__
+#define __UPLOAD_H__
+
+#include "hal.h"
+#include "keyboard.h"
+#include "crc.h"
+
+// Chunks the host may send before the first one is acknowledged, and
+// largest payload of a chunk. A full window must fit in the serial receive
+// buffer, so that the host can send it at full speed even while the
+// firmware is busy.
+#define UPLOAD_WINDOW 2
+#define UPLOAD_CHUNK_BYTES 23
+// Bytes of a chunk message besides its payload
+#define UPLOAD_CHUNK_OVERHEAD 8
+// The ring buffer of HardwareSerial holds one byte less than its size
+#define UPLOAD_RX_BUFFER (SERIAL_RX_BUFFER_SIZE - 1)
+static_assert(UPLOAD_WINDOW * (UPLOAD_CHUNK_BYTES + UPLOAD_CHUNK_OVERHEAD)
+              <= UPLOAD_RX_BUFFER, "An upload window overruns the RX buffer");
+
+/**
+ * Replies to the upload messages: F0 7D 12, status, sequence number, F7.
+ */
+enum UploadStatus : uint8_t
+{
+  UPLOAD_ACK = 0x00,   // Every chunk up to the sequence number was received
+  UPLOAD_NAK = 0x01,   // Send the chunks again from the sequence number
+  UPLOAD_DONE = 0x02,  // Last chunk received, the layout is applied
+  UPLOAD_ERROR = 0x03, // No upload going on, or the upload is aborted
+  UPLOAD_READY = 0x04, // Upload started, followed by the window size and
+                       // the largest payload instead of a sequence number
+  UPLOAD_NONE = 0xFF   // No reply
+};
+
+/**
+ * Receives a layout in acknowledged chunks, so that a host can send it at
+ * full speed without overrunning the serial buffer, and a corrupted chunk
+ * is sent again instead of ending up as NullButtons.
+ *
+ * The host starts with F0 7D 10, keyboard type, layout size (2 bytes, 7
+ * bits at a time, low bits first), F7. The layout is what follows
+ * F0 7D 02 type in a layout SysEx. It then sends chunks:
+ * F0 7D 11, sequence number, 1 to UPLOAD_CHUNK_BYTES bytes of the layout,
+ * CRC16 of the sequence number and payload (3 bytes, see crc16_to_sysex),
+ * F7. Sequence numbers start at 0 and wrap at 128.
+ *
+ * At most UPLOAD_WINDOW chunks may be waiting for their ACK. Go-back-N:
+ * the firmware only takes chunks in order. A corrupted chunk, or one
+ * following a lost chunk, gets a single NAK with the sequence number to
+ * resend from; the chunks after it in the window are dropped silently. A
+ * chunk already received is acknowledged again. The layout is applied all
+ * at once after its last byte, like a layout SysEx.
+ */
+class LayoutUpload
+{
+  public:
+    LayoutUpload() : keyboard(nullptr)
+    {};
+    bool active() const { return keyboard != nullptr; }
+    bool begin(Keyboard *keyboard, uint16_t size);
+    uint8_t chunk(const byte *data, unsigned size, uint8_t &seq);
+    void abort();
+  private:
+    Keyboard *keyboard;
+    // Layout bytes still to receive
+    uint16_t remaining;
+    uint8_t next_seq;
+    // A NAK was sent for next_seq
+    bool nak_sent;
+};
+
+extern LayoutUpload layout_upload;
+
+#endif //__UPLOAD_H__
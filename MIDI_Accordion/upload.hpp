@@ -0,0 +1,104 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "upload.h"
+
+LayoutUpload layout_upload;
+
+/**
+ * Start receiving a layout of size bytes for a keyboard, dropping any
+ * upload going on.
+ */
+bool LayoutUpload::begin(Keyboard *keyboard, uint16_t size)
+{
+  abort();
+  if(!keyboard || !size)
+    return false;
+  this->keyboard = keyboard;
+  remaining = size;
+  next_seq = 0;
+  nak_sent = false;
+  keyboard->beginEdition();
+  return true;
+}
+
+/**
+ * Drop the upload going on, if any.
+ */
+void LayoutUpload::abort()
+{
+  if(keyboard)
+    keyboard->clearEdition();
+  keyboard = nullptr;
+}
+
+/**
+ * Handle a 0x11 chunk message, boundaries included. Return the status to
+ * reply with, and set seq to its sequence number.
+ */
+uint8_t LayoutUpload::chunk(const byte *data, unsigned size, uint8_t &seq)
+{
+  if(!keyboard) {
+    seq = size > 3 ? data[3] : 0;
+    return UPLOAD_ERROR;
+  }
+  seq = next_seq;
+  const bool whole = size > UPLOAD_CHUNK_OVERHEAD
+                     && size <= UPLOAD_CHUNK_OVERHEAD + UPLOAD_CHUNK_BYTES
+                     && data[size-1] == 0xF7;
+  uint16_t crc = CRC16_INIT;
+  for(unsigned i=3; whole && i<size-4; i++)
+    crc = crc16_update(crc, data[i]);
+  byte check[3];
+  crc16_to_sysex(crc, check);
+  if(!whole || memcmp(check, data+size-4, 3)) {
+    // Corrupted, start again from the chunk expected
+    if(nak_sent)
+      return UPLOAD_NONE;
+    nak_sent = true;
+    return UPLOAD_NAK;
+  }
+  if(data[3] != next_seq) {
+    if(((next_seq - data[3]) & 0x7F) <= UPLOAD_WINDOW) {
+      // Received already, its ACK was lost
+      seq = (next_seq - 1) & 0x7F;
+      return UPLOAD_ACK;
+    }
+    // A chunk before it was lost
+    if(nak_sent)
+      return UPLOAD_NONE;
+    nak_sent = true;
+    return UPLOAD_NAK;
+  }
+  const unsigned length = size - UPLOAD_CHUNK_OVERHEAD;
+  if(length > remaining) {
+    abort();
+    return UPLOAD_ERROR;
+  }
+  keyboard->editFromSysEx(data+4, length);
+  remaining -= length;
+  next_seq = (next_seq + 1) & 0x7F;
+  nak_sent = false;
+  if(remaining)
+    return UPLOAD_ACK;
+  Keyboard *const done = keyboard;
+  keyboard = nullptr;
+  return done->commitEdition() ? UPLOAD_DONE : UPLOAD_ERROR;
+}
@@ -0,0 +1,103 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef BASE64_HPP
+#define BASE64_HPP
+
+/*
+ * Host replacement of the base64 Arduino library
+ * (https://github.com/Densaugeo/base64_arduino), for the host build when
+ * the library isn't installed. Only the functions the firmware uses, with
+ * the same behavior: the output is null terminated, and decoding stops at
+ * the first character that isn't base64 (the '=' padding included).
+ */
+
+inline unsigned char binary_to_base64(unsigned char v)
+{
+  if(v < 26) return v + 'A';
+  if(v < 52) return v - 26 + 'a';
+  if(v < 62) return v - 52 + '0';
+  return v == 62 ? '+' : '/';
+}
+
+inline unsigned char base64_to_binary(unsigned char c)
+{
+  if(c >= 'A' && c <= 'Z') return c - 'A';
+  if(c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if(c >= '0' && c <= '9') return c - '0' + 52;
+  if(c == '+') return 62;
+  if(c == '/') return 63;
+  return 0xFF;
+}
+
+inline unsigned int encode_base64_length(unsigned int input_length)
+{
+  return (input_length + 2) / 3 * 4;
+}
+
+inline unsigned int decode_base64_length(const unsigned char input[],
+                                         unsigned int input_length)
+{
+  unsigned int length = 0;
+  while(length < input_length && base64_to_binary(input[length]) != 0xFF)
+    length++;
+  return length / 4 * 3 + (length % 4 ? length % 4 - 1 : 0);
+}
+
+inline unsigned int encode_base64(const unsigned char input[],
+                                  unsigned int input_length,
+                                  unsigned char output[])
+{
+  unsigned int o = 0;
+  for(unsigned int i=0; i<input_length; i+=3) {
+    const unsigned int left = input_length - i;
+    const unsigned long v = (unsigned long)input[i] << 16
+                            | (left > 1 ? input[i+1] << 8 : 0)
+                            | (left > 2 ? input[i+2] : 0);
+    output[o++] = binary_to_base64(v >> 18);
+    output[o++] = binary_to_base64((v >> 12) & 0x3F);
+    output[o++] = left > 1 ? binary_to_base64((v >> 6) & 0x3F) : '=';
+    output[o++] = left > 2 ? binary_to_base64(v & 0x3F) : '=';
+  }
+  output[o] = '\0';
+  return o;
+}
+
+inline unsigned int decode_base64(const unsigned char input[],
+                                  unsigned int input_length,
+                                  unsigned char output[])
+{
+  const unsigned int length = decode_base64_length(input, input_length);
+  unsigned long bits = 0;
+  unsigned int count = 0;
+  unsigned int o = 0;
+  for(unsigned int i=0; o<length; i++) {
+    bits = bits << 6 | base64_to_binary(input[i]);
+    count += 6;
+    if(count >= 8) {
+      count -= 8;
+      output[o++] = bits >> count;
+    }
+  }
+  output[o] = '\0';
+  return o;
+}
+
+#endif //BASE64_HPP
@@ -0,0 +1,105 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Chunk boundary benchmark: the default right layout is received as two
+ * SysEx chunks, split at every byte after its header, as the MIDI library
+ * splits messages longer than its buffer. Each split must give the layout
+ * received in one piece. Reports the time to receive a layout and the
+ * throughput of the decoder.
+ */
+#include "host.h"
+
+/**
+ * The state a layout leaves the right keyboard in.
+ */
+struct Received
+{
+  unsigned char name[MAX_NAME_LENGTH];
+  Button buttons[MAX_KEYBOARD_BUTTONS];
+  ExpressionTarget expression[MAX_EXPRESSION_TARGETS];
+
+  void read()
+  {
+    memset(this, 0, sizeof(*this));
+    memcpy(name, right_keyboard.name, sizeof(name));
+    for(uint8_t i=0; i<right_keyboard.buttonCount(); i++)
+      buttons[i] = *right_keyboard.getButton(i / 8, i % 8);
+    memcpy(expression, right_keyboard.expression, sizeof(expression));
+  }
+  bool operator==(const Received &other) const
+  {
+    return !memcmp(this, &other, sizeof(*this));
+  }
+};
+
+/**
+ * Receive the layout split after its first split bytes (0: in one piece).
+ */
+void receive(unsigned split)
+{
+  const unsigned size = sizeof(right_keyboard_default);
+  static byte first[sizeof(right_keyboard_default) + 1];
+  static byte second[sizeof(right_keyboard_default) + 1];
+  if(split == 0) {
+    memcpy(first, right_keyboard_default, size);
+    systemExclusiveHandler(first, size);
+    return;
+  }
+  memcpy(first, right_keyboard_default, split);
+  first[split] = 0xF0;
+  second[0] = 0xF7;
+  memcpy(second + 1, right_keyboard_default + split, size - split);
+  systemExclusiveHandler(first, split + 1);
+  systemExclusiveHandler(second, size - split + 1);
+}
+
+int main(int argc, char **argv)
+{
+  const unsigned rounds = host_quick(argc, argv) ? 10 : 20000;
+  const unsigned size = sizeof(right_keyboard_default);
+  setup();
+  receive(0);
+  Received expected, received;
+  expected.read();
+
+  // The header (F0 7D 02 type) is read from the first chunk
+  const unsigned first_split = 4;
+  unsigned long layouts = 0;
+  HostTimer timer;
+  for(unsigned round=0; round<rounds; round++) {
+    for(unsigned split=first_split; split<size; split++) {
+      right_keyboard.clear();
+      memset(right_keyboard.name, 0, sizeof(right_keyboard.name));
+      receive(split);
+      layouts++;
+      if(round == 0) {
+        received.read();
+        CHECK(received == expected);
+      }
+    }
+  }
+  const double seconds = timer.seconds();
+  printf("%u bytes, %u split points\n", size, size - first_split);
+  printf("%-12s %10s %10s\n", "", "us/layout", "MB/s");
+  printf("%-12s %10.2f %10.2f\n", "split", seconds * 1e6 / layouts,
+         (double)layouts * size / seconds / 1e6);
+  return host_result();
+}
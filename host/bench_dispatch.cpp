@@ -0,0 +1,111 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Key event dispatch benchmark: a button press and release sent through
+ * the MIDI library calls (sendNoteOn() and friends, the path before the
+ * buttons were compiled to wire bytes), as precompiled wire bytes written
+ * straight to the UART, and through midi_out as the firmware does now.
+ * Reports the host time and the MIDI bytes of an event.
+ *
+ * On the host the library calls are sim.h's, which skip the checks of the
+ * real library (channel, running status and thru settings): the library
+ * row is a lower bound of its cost on the board. midi_out also pays for
+ * its queues and for tracking the notes sounding.
+ */
+#include "host.h"
+
+/**
+ * The buttons of the default right layout, a note each.
+ */
+uint8_t note_buttons(const Button **buttons)
+{
+  uint8_t count = 0;
+  for(uint8_t i=0; i<right_keyboard.buttonCount(); i++) {
+    const Button *button = right_keyboard.getButton(i / 8, i % 8);
+    if(button->type == NOTE_BUTTON)
+      buttons[count++] = button;
+  }
+  return count;
+}
+
+/**
+ * Press and release through the library, decoding the fields of the
+ * button as the old button classes kept them.
+ */
+void library_event(const Button &button)
+{
+  const uint8_t channel = (button.message[0] & 0x0F) + 1;
+  MIDI.sendNoteOn(button.message[1], button.message[2], channel);
+  MIDI.sendNoteOff(button.message[1], button.message[2], channel);
+}
+
+/**
+ * Press and release as wire bytes written straight to the UART.
+ */
+void direct_event(const Button &button)
+{
+  const byte note_off[3] = {(byte)(button.message[0] - 0x10),
+                            button.message[1], button.message[2]};
+  MIDI_SERIAL.write(button.message, 3);
+  MIDI_SERIAL.write(note_off, 3);
+}
+
+/**
+ * Press and release as wire bytes through midi_out, as the firmware does:
+ * queued, tracked in the active notes, then written as the UART has room.
+ */
+void queued_event(const Button &button)
+{
+  button.on();
+  // Sent before its note-off comes in, which would cancel both
+  midi_out.drain();
+  button.off();
+  midi_out.drain();
+}
+
+template<typename Event>
+void run(const char *name, Event event, const Button **buttons,
+         uint8_t count, unsigned long events)
+{
+  const unsigned long bytes = Serial.tx_len;
+  HostTimer timer;
+  for(unsigned long i=0; i<events; i++) {
+    // Give the UART the time to send the 6 bytes of the previous event
+    sim_micros += 6 * SIM_BYTE_US;
+    event(*buttons[i % count]);
+  }
+  const double seconds = timer.seconds();
+  printf("%-12s %10.1f %10.2f\n", name, seconds * 1e9 / events,
+         (double)(Serial.tx_len - bytes) / events);
+}
+
+int main(int argc, char **argv)
+{
+  const unsigned long events = host_quick(argc, argv) ? 10000 : 5000000;
+  setup();
+  const Button *buttons[MAX_KEYBOARD_BUTTONS];
+  const uint8_t count = note_buttons(buttons);
+  printf("%-12s %10s %10s\n", "path", "ns/event", "bytes/event");
+  run("library", library_event, buttons, count, events);
+  run("wire bytes", direct_event, buttons, count, events);
+  run("midi_out", queued_event, buttons, count, events);
+  return 0;
+}
@@ -0,0 +1,95 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Scan interrupt benchmark, built with TIMER_SCAN: the run time of
+ * scan_tick(), which the timer interrupt calls every
+ * SCAN_PERIOD_US / GROUP_COUNT. The last tick of a scan also diffs the
+ * matrix and pushes the changes to the queue, it is reported apart.
+ * Reports the host time of a tick (median, 99.9th percentile, worst), and
+ * its simulated time (the settle delay) against the tick period.
+ */
+// Before host.h, see there
+#include <algorithm>
+#include <vector>
+#include "host.h"
+
+/**
+ * Run times of one kind of tick.
+ */
+struct TickTimes
+{
+  std::vector<float> ns;
+  unsigned long sim_us = 0;
+
+  void add(double tick_ns, unsigned long us)
+  {
+    ns.push_back(tick_ns);
+    sim_us += us;
+  }
+  /**
+   * Median, 99.9th percentile and worst time. The worst one mostly shows
+   * the host being preempted.
+   */
+  void print(const char *name)
+  {
+    std::sort(ns.begin(), ns.end());
+    printf("%-12s %10.1f %10.1f %10.1f %10.2f %10.1f%%\n", name,
+           ns[ns.size() / 2], ns[ns.size() * 999 / 1000], ns.back(),
+           (double)sim_us / ns.size(),
+           100.0 * sim_us / ns.size() / (SCAN_PERIOD_US / GROUP_COUNT));
+  }
+};
+
+int main(int argc, char **argv)
+{
+  const unsigned long scans = host_quick(argc, argv) ? 1000 : 200000;
+  setup();
+  TickTimes group_ticks;
+  TickTimes diff_ticks;
+  unsigned long events = 0;
+  for(unsigned long scan=0; scan<scans; scan++) {
+    // A key of each keyboard changes every 8 scans
+    if(scan % 8 == 0) {
+      sim_right_matrix[scan / 8 % GROUP_COUNT] ^= 0x01;
+      sim_left_matrix[scan / 8 % GROUP_COUNT] ^= 0x80;
+    }
+    for(uint8_t group=0; group<GROUP_COUNT; group++) {
+      sim_micros += SCAN_PERIOD_US / GROUP_COUNT;
+      const unsigned long start = sim_micros;
+      HostTimer timer;
+      scan_tick();
+      const double ns = timer.seconds() * 1e9;
+      (group == GROUP_COUNT - 1 ? diff_ticks : group_ticks)
+        .add(ns, sim_micros - start);
+    }
+    // loop() empties the queue between two scans
+    KeyEvent event;
+    while(key_event_queue.pop(event))
+      events++;
+  }
+  printf("%lu scans, %lu key events, tick period %d us\n", scans, events,
+         SCAN_PERIOD_US / GROUP_COUNT);
+  printf("%-12s %10s %10s %10s %10s %11s\n", "tick", "median ns",
+         "99.9% ns", "max ns", "sim us", "of period");
+  group_ticks.print("group");
+  diff_ticks.print("group+diff");
+  return 0;
+}
@@ -0,0 +1,72 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Layout dump benchmark: the bytes of the layout SysEx of each keyboard,
+ * with a base64 and a packed name, the host time to write it and to decode
+ * it back, and the simulated time the firmware waits on the full TX buffer
+ * while writing it (the dump goes straight to the serial port).
+ */
+#include "host.h"
+
+void run(const char *name, Keyboard &keyboard, bool packed,
+         unsigned long dumps)
+{
+  static byte sent[1024];
+  HostMidiLog log;
+  keyboard.send(packed);
+  const unsigned size = log.lastSysEx(0x02, sent, sizeof(sent));
+
+  const unsigned long start_us = sim_micros;
+  HostTimer timer;
+  for(unsigned long i=0; i<dumps; i++)
+    keyboard.send(packed);
+  const double dump_seconds = timer.seconds();
+  const double blocked_us = (double)(sim_micros - start_us) / dumps;
+
+  static unsigned char decoded_name[MAX_NAME_LENGTH];
+  static Button decoded_buttons[MAX_KEYBOARD_BUTTONS];
+  static ExpressionTarget decoded_expression[MAX_EXPRESSION_TARGETS];
+  LayoutDecoder decoder;
+  HostTimer decode_timer;
+  for(unsigned long i=0; i<dumps; i++) {
+    decoder.begin(decoded_name, decoded_buttons, keyboard.buttonCount(),
+                  decoded_expression);
+    decoder.feed(sent + 4, size - 4);
+  }
+  const double decode_seconds = decode_timer.seconds();
+
+  printf("%-16s %8u %12.2f %12.2f %12.1f\n", name, size,
+         dump_seconds * 1e6 / dumps, decode_seconds * 1e6 / dumps,
+         blocked_us / 1000);
+}
+
+int main(int argc, char **argv)
+{
+  const unsigned long dumps = host_quick(argc, argv) ? 10 : 100000;
+  setup();
+  printf("%-16s %8s %12s %12s %12s\n", "layout", "bytes", "us/dump",
+         "us/decode", "sim ms/dump");
+  run("right base64", right_keyboard, false, dumps);
+  run("right packed", right_keyboard, true, dumps);
+  run("left base64", left_keyboard, false, dumps);
+  run("left packed", left_keyboard, true, dumps);
+  return 0;
+}
@@ -0,0 +1,156 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Scan loop benchmark: replays scripted key matrix sequences and reports,
+ * for each, the loop() iterations per second on the host, the key edges
+ * played and the MIDI bytes they gave, and the simulated time (settle
+ * delays, waits for the UART) and digitalWrite calls of an iteration.
+ *
+ * Built twice, with the port matrix driver (bench_scan) and with
+ * DIGITALWRITE_MATRIX (bench_scan_digitalwrite). The host runs both at
+ * about the same speed, so each also gives the scan rate of the Mega
+ * estimated from the simulated time and the cost of its pin writes.
+ */
+#include "host.h"
+
+// Simulated time of the rest of an iteration of loop() on the board
+#define BENCH_LOOP_US 300
+// Estimated cost of driving a group pin on the Mega at 16 MHz: a
+// digitalWrite (3 table lookups in flash, PWM check, interrupts saved and
+// disabled around the write), or a read-modify-write through group_ports.
+#define BENCH_CPU_MHZ 16
+#define BENCH_DIGITALWRITE_CYCLES 54
+#define BENCH_PORT_WRITE_CYCLES 10
+
+/**
+ * A scripted sequence: which keys are down at a given iteration.
+ */
+struct Scenario
+{
+  const char *name;
+  void (*keys)(unsigned long iteration);
+};
+
+void idle(unsigned long iteration)
+{
+  (void)iteration;
+}
+
+/**
+ * Up and down the right keyboard, a key every 40 iterations.
+ */
+void scale(unsigned long iteration)
+{
+  memset(sim_right_matrix, 0, sizeof(sim_right_matrix));
+  const unsigned step = (iteration / 40) % 162;
+  const unsigned key = step < 81 ? step : 161 - step;
+  sim_right_matrix[key / 8] = 1 << (key % 8);
+}
+
+/**
+ * Trill between two neighbouring keys of the right keyboard, every 40
+ * iterations, over a bass and chord held on the left keyboard.
+ */
+void trill(unsigned long iteration)
+{
+  sim_right_matrix[2] = (iteration / 40) % 2 ? 0x01 : 0x02;
+  sim_left_matrix[0] = 0x01;
+  sim_left_matrix[6] = 0x01;
+}
+
+/**
+ * Every key of both keyboards pressed and released together, every 50
+ * iterations.
+ */
+void cluster(unsigned long iteration)
+{
+  const uint8_t value = (iteration / 50) % 2 ? 0xFF : 0x00;
+  memset(sim_right_matrix, value, sizeof(sim_right_matrix));
+  memset(sim_left_matrix, value, sizeof(sim_left_matrix));
+}
+
+const Scenario scenarios[] = {
+  {"idle", idle},
+  {"scale", scale},
+  {"trill", trill},
+  {"cluster", cluster},
+};
+
+/**
+ * Number of keys that differ between two copies of a matrix.
+ */
+unsigned long changed_keys(const uint8_t *a, const uint8_t *b)
+{
+  unsigned long count = 0;
+  for(uint8_t group=0; group<SIM_GROUPS; group++)
+    count += __builtin_popcount(a[group] ^ b[group]);
+  return count;
+}
+
+int main(int argc, char **argv)
+{
+  const unsigned long iterations = host_quick(argc, argv) ? 2000 : 200000;
+  setup();
+  #ifdef DIGITALWRITE_MATRIX
+  printf("Matrix driven with digitalWrite\n");
+  #else
+  printf("Matrix driven through the port registers\n");
+  #endif
+  printf("%-8s %12s %10s %10s %12s %12s %14s\n", "scenario", "scans/s",
+         "key edges", "MIDI bytes", "sim us/scan", "pin writes",
+         "Mega scans/s");
+  for(const Scenario &scenario : scenarios) {
+    memset(sim_right_matrix, 0, sizeof(sim_right_matrix));
+    memset(sim_left_matrix, 0, sizeof(sim_left_matrix));
+    host_run(100);
+    unsigned long edges = 0;
+    unsigned long sim_time = 0;
+    const unsigned long bytes = Serial.tx_len;
+    const unsigned long writes = sim_digital_writes;
+    HostTimer timer;
+    for(unsigned long i=0; i<iterations; i++) {
+      uint8_t right[SIM_GROUPS], left[SIM_GROUPS];
+      memcpy(right, sim_right_matrix, sizeof(right));
+      memcpy(left, sim_left_matrix, sizeof(left));
+      scenario.keys(i);
+      edges += changed_keys(right, sim_right_matrix)
+               + changed_keys(left, sim_left_matrix);
+      sim_micros += BENCH_LOOP_US;
+      const unsigned long start = sim_micros;
+      loop();
+      sim_time += sim_micros - start;
+    }
+    const double seconds = timer.seconds();
+    const double digital_writes = (double)(sim_digital_writes - writes)
+                                  / iterations;
+    #ifdef DIGITALWRITE_MATRIX
+    const double pin_cycles = digital_writes * BENCH_DIGITALWRITE_CYCLES;
+    #else
+    const double pin_cycles = 2 * GROUP_COUNT * BENCH_PORT_WRITE_CYCLES;
+    #endif
+    const double scan_us = (double)sim_time / iterations
+                           + pin_cycles / BENCH_CPU_MHZ;
+    printf("%-8s %12.0f %10lu %10lu %12.1f %12.1f %14.0f\n", scenario.name,
+           iterations / seconds, edges, Serial.tx_len - bytes,
+           (double)sim_time / iterations, digital_writes, 1e6 / scan_us);
+  }
+  return 0;
+}
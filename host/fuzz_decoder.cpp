@@ -0,0 +1,115 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * LayoutDecoder fuzz harness: any input, split anywhere into SysEx chunks,
+ * decodes to the same name, buttons and expression targets as the input
+ * in one piece, and leaves a name that is null terminated.
+ *
+ * Built as a libFuzzer target with -DHOST_FUZZ=ON (clang only). Otherwise
+ * main() runs it on random inputs, as a test.
+ */
+#include "host.h"
+
+/**
+ * What the decoder wrote.
+ */
+struct Decoded
+{
+  unsigned char name[MAX_NAME_LENGTH];
+  Button buttons[MAX_KEYBOARD_BUTTONS];
+  ExpressionTarget expression[MAX_EXPRESSION_TARGETS];
+};
+
+/**
+ * Decode data, split into chunks of chunk bytes as the MIDI library would:
+ * an 0xF0 at the end of each chunk but the last one, and an 0xF7 at the
+ * start of each chunk but the first one. chunk 0 feeds it in one piece.
+ */
+void decode(const uint8_t *data, size_t size, uint8_t button_count,
+            size_t chunk, Decoded &out)
+{
+  memset(&out, 0x55, sizeof(out));
+  LayoutDecoder decoder;
+  decoder.begin(out.name, out.buttons, button_count, out.expression);
+  if(chunk == 0) {
+    decoder.feed(data, size);
+    return;
+  }
+  for(size_t i=0; i<size; i+=chunk) {
+    if(i > 0)
+      decoder.feed(0xF7);
+    decoder.feed(data + i, min(chunk, size - i));
+    if(i + chunk < size)
+      decoder.feed(0xF0);
+  }
+}
+
+/**
+ * The first byte gives the number of buttons and the chunk size, the rest
+ * is the layout.
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  if(size < 1)
+    return 0;
+  const uint8_t button_count = 1 + data[0] % MAX_KEYBOARD_BUTTONS;
+  const size_t chunk = 1 + (data[0] >> 4);
+  static Decoded whole, split;
+  decode(data + 1, size - 1, button_count, 0, whole);
+  CHECK(memchr(whole.name, '\0', sizeof(whole.name)) != nullptr);
+  const size_t chunks[] = {1, 2, 3, 7, chunk};
+  for(size_t c : chunks) {
+    decode(data + 1, size - 1, button_count, c, split);
+    CHECK(!memcmp(&whole, &split, sizeof(whole)));
+  }
+  #ifdef HOST_LIBFUZZER
+  if(host_failures)
+    abort();
+  #endif
+  return 0;
+}
+
+#ifndef HOST_LIBFUZZER
+/**
+ * A random input, mostly data bytes, sometimes starting as a valid name so
+ * that the buttons and expression targets are reached.
+ */
+size_t random_input(uint8_t *data, size_t room)
+{
+  const size_t size = 1 + rand() % room;
+  for(size_t i=0; i<size; i++)
+    data[i] = rand() % 8 ? rand() & 0x7F : rand();
+  if(size > 4 && rand() % 2) {
+    const uint8_t name[] = {'Q', 'Q', '=', '=', 0x00};
+    memcpy(data + 1, name, min(sizeof(name), size - 1));
+  }
+  return size;
+}
+
+int main()
+{
+  srand(1);
+  uint8_t data[512];
+  for(unsigned i=0; i<20000 && !host_failures; i++)
+    LLVMFuzzerTestOneInput(data, random_input(data, sizeof(data)));
+  return host_result();
+}
+#endif
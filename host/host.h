@@ -0,0 +1,243 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#ifndef __HOST_H__
+#define __HOST_H__
+
+/*
+ * Helpers of the host test and benchmark programs, which include the whole
+ * sketch through this header and drive it as sim.h describes.
+ */
+
+// Standard headers first: sim.h defines min() and max() as macros
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MIDI_Accordion.ino"
+
+/*
+ * Checks
+ */
+int host_failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if(!(condition)) { \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      host_failures++; \
+    } \
+  } while(0)
+
+#define CHECK_EQUAL(actual, expected) \
+  do { \
+    const long long a_ = (actual), e_ = (expected); \
+    if(a_ != e_) { \
+      printf("%s:%d: check failed: %s is %lld, expected %lld\n", \
+             __FILE__, __LINE__, #actual, a_, e_); \
+      host_failures++; \
+    } \
+  } while(0)
+
+/**
+ * Exit status of a test: report the failures.
+ */
+inline int host_result()
+{
+  if(host_failures)
+    printf("%d check(s) failed\n", host_failures);
+  return host_failures ? 1 : 0;
+}
+
+/*
+ * Driving the sketch
+ */
+
+/**
+ * Run loop() count times, advancing the simulated clock by us before each.
+ */
+inline void host_run(unsigned long count, unsigned long us = 300)
+{
+  for(unsigned long i=0; i<count; i++) {
+    sim_micros += us;
+    loop();
+  }
+}
+
+/**
+ * Press (or release) a key: index 0 to 7 is on the right keyboard, 8 to 15
+ * on the left one.
+ */
+inline void host_key(uint8_t group, uint8_t index, bool pressed)
+{
+  uint8_t *matrix = index < 8 ? sim_right_matrix : sim_left_matrix;
+  const uint8_t mask = 1 << (index % 8);
+  if(pressed)
+    matrix[group] |= mask;
+  else
+    matrix[group] &= ~mask;
+}
+
+/**
+ * MIDI messages written to the serial port from some point on, parsed back
+ * with running status.
+ */
+class HostMidiLog
+{
+  public:
+    HostMidiLog() { mark(); }
+    // Only look at what is written from now on
+    void mark() { start = Serial.tx_len; }
+    // Number of bytes written since the mark
+    unsigned long bytes() const { return Serial.tx_len - start; }
+    uint8_t byteAt(unsigned long i) const
+    {
+      return Serial.sim_tx[(start + i) % SIM_TX_SIZE];
+    }
+
+    /**
+     * Call handler(status, data1, data2) for each channel message, and
+     * handler(0xF0, offset, size) for each SysEx (offset of its 0xF0).
+     */
+    template<typename Handler> void parse(Handler handler) const
+    {
+      uint8_t status = 0;
+      uint8_t data[2];
+      uint8_t count = 0;
+      unsigned long sysex = 0;
+      bool in_sysex = false;
+      for(unsigned long i=0; i<bytes(); i++) {
+        const uint8_t b = byteAt(i);
+        if(b == 0xF0) {
+          in_sysex = true;
+          sysex = i;
+          continue;
+        }
+        if(b == 0xF7) {
+          if(in_sysex)
+            handler(0xF0, sysex, i + 1 - sysex);
+          in_sysex = false;
+          continue;
+        }
+        if(in_sysex)
+          continue;
+        if(b & 0x80) {
+          status = b;
+          count = 0;
+          continue;
+        }
+        data[count++] = b;
+        const uint8_t needed = (status & 0xE0) == 0xC0 ? 1 : 2;
+        if(count == needed) {
+          handler(status, data[0], needed == 2 ? data[1] : 0);
+          count = 0;
+        }
+      }
+    }
+
+    unsigned long noteOns() const
+    {
+      unsigned long count = 0;
+      parse([&](uint8_t s, unsigned long, unsigned long v) {
+        count += (s & 0xF0) == 0x90 && v;
+      });
+      return count;
+    }
+    unsigned long noteOffs() const
+    {
+      unsigned long count = 0;
+      parse([&](uint8_t s, unsigned long, unsigned long v) {
+        count += (s & 0xF0) == 0x80 || ((s & 0xF0) == 0x90 && !v);
+      });
+      return count;
+    }
+    unsigned long messages() const
+    {
+      unsigned long count = 0;
+      parse([&](uint8_t, unsigned long, unsigned long) { count++; });
+      return count;
+    }
+
+    /**
+     * Copy the last SysEx whose command (third byte) is command to data, at
+     * most size bytes. Return its size, 0 if there is none.
+     */
+    unsigned lastSysEx(uint8_t command, byte *data, unsigned size) const
+    {
+      unsigned found = 0;
+      parse([&](uint8_t s, unsigned long offset, unsigned long length) {
+        if(s != 0xF0 || length < 3 || byteAt(offset + 2) != command)
+          return;
+        found = min(length, (unsigned long)size);
+        for(unsigned i=0; i<found; i++)
+          data[i] = byteAt(offset + i);
+      });
+      return found;
+    }
+  private:
+    unsigned long start;
+};
+
+/**
+ * Deliver a whole SysEx to the firmware, as a single chunk, and copy its
+ * reply (the last SysEx with the same command written) to reply. Return
+ * the reply size, 0 if there is none.
+ */
+inline unsigned host_sysex(const byte *data, unsigned size,
+                           byte *reply = nullptr, unsigned reply_size = 0)
+{
+  byte copy[SIM_SYSEX_SIZE];
+  memcpy(copy, data, size);
+  HostMidiLog log;
+  MIDI.receiveSysEx(copy, size);
+  return reply ? log.lastSysEx(data[2], reply, reply_size) : 0;
+}
+
+/*
+ * Benchmarks
+ */
+
+/**
+ * True if the benchmark was started with --quick (a short pass run by
+ * ctest).
+ */
+inline bool host_quick(int argc, char **argv)
+{
+  return argc > 1 && !strcmp(argv[1], "--quick");
+}
+
+/**
+ * Wall-clock time of the host.
+ */
+class HostTimer
+{
+  public:
+    HostTimer() : start(std::chrono::steady_clock::now()) {}
+    double seconds() const
+    {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                           - start).count();
+    }
+  private:
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif //__HOST_H__
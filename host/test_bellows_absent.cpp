@@ -0,0 +1,61 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Bellows sensor missing: a chip answering at the BMP180 address with
+ * another id (a BMP280) is not calibrated, so it is never read, no
+ * expression is sent, and the keys still play.
+ */
+#include "host.h"
+
+int main()
+{
+  // A sensor whose begin() never succeeded doesn't start conversions
+  Bmp180 uncalibrated;
+  unsigned long transactions = Wire.transactions;
+  for(uint8_t i=0; i<100; i++) {
+    sim_micros += 30000;
+    CHECK(!uncalibrated.update());
+  }
+  CHECK_EQUAL(Wire.transactions, transactions);
+
+  sim_bmp180.id = 0x58;
+  CHECK(!Bmp180().begin());
+  setup();
+  CHECK(!bellows_present);
+
+  // The pressure moves, but the sensor isn't polled and nothing is sent
+  HostMidiLog log;
+  transactions = Wire.transactions;
+  const uint32_t ambient = sim_bmp180.up;
+  for(unsigned i=0; i<2000; i++) {
+    sim_bmp180.up = ambient + i;
+    host_run(1);
+  }
+  CHECK_EQUAL(Wire.transactions, transactions);
+  CHECK_EQUAL(log.messages(), 0);
+  CHECK_EQUAL(expression_controller.suppressedCount(), 0);
+
+  host_key(0, 0, true);
+  host_run(10);
+  CHECK_EQUAL(log.noteOns(), 1);
+
+  return host_result();
+}
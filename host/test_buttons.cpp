@@ -0,0 +1,104 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Button records: each type is compiled to its wire bytes and written back
+ * to the same record, channels go from 1 to 16, and channel 0 (which never
+ * sent anything) gives a NullButton. A 0x08 SysEx reads the records back,
+ * and a cut or invalid one gets an error reply.
+ */
+#include "host.h"
+
+/**
+ * Read a record and write it back. Return the length written.
+ */
+uint8_t round_trip(const byte *record, Button &button, byte *written)
+{
+  button = Button::fromBytes(record);
+  return button.toBytes(written);
+}
+
+int main()
+{
+  setup();
+  Button button;
+  byte written[MAX_BUTTON_RECORD];
+
+  const byte note[] = {NOTE_BUTTON, 1, 60, 100};
+  CHECK_EQUAL(round_trip(note, button, written), 4);
+  CHECK_EQUAL(button.message[0], 0x90);
+  CHECK_EQUAL(button.message[1], 60);
+  CHECK_EQUAL(button.message[2], 100);
+  CHECK(!memcmp(written, note, sizeof(note)));
+
+  const byte control[] = {CONTROL_BUTTON, 16, 64, 127};
+  CHECK_EQUAL(round_trip(control, button, written), 4);
+  CHECK_EQUAL(button.message[0], 0xBF);
+  CHECK(!memcmp(written, control, sizeof(control)));
+
+  const byte program[] = {PROGRAM_BUTTON, 10, 5};
+  CHECK_EQUAL(round_trip(program, button, written), 3);
+  CHECK_EQUAL(button.message[0], 0xC9);
+  CHECK(!memcmp(written, program, sizeof(program)));
+
+  // Channel 0 and channels past 16 send nothing
+  const byte silent[] = {NOTE_BUTTON, 0, 60, 100};
+  CHECK_EQUAL(Button::fromBytes(silent).type, NULL_BUTTON);
+  const byte too_high[] = {NOTE_BUTTON, 17, 60, 100};
+  CHECK_EQUAL(Button::fromBytes(too_high).type, NULL_BUTTON);
+
+  // A NullButton is a single byte
+  const byte null[] = {NULL_BUTTON};
+  CHECK_EQUAL(round_trip(null, button, written), 1);
+  CHECK_EQUAL(written[0], NULL_BUTTON);
+
+  // Pressing a note button writes its precompiled bytes
+  HostMidiLog log;
+  Button::fromBytes(control).on();
+  midi_out.drain();
+  CHECK_EQUAL(log.bytes(), 3);
+  CHECK_EQUAL(log.byteAt(0), 0xBF);
+  CHECK_EQUAL(log.byteAt(1), 64);
+  CHECK_EQUAL(log.byteAt(2), 127);
+
+  // The first two buttons of the right keyboard
+  byte reply[8 + MAX_BUTTON_RECORD*GET_BUTTONS_MAX];
+  const byte get[] = {0xF0, 0x7D, 0x08, 0x01, 0x00, 0x00, 0x02, 0xF7};
+  byte expected[8 + 2*MAX_BUTTON_RECORD] = {0xF0, 0x7D, 0x08, 0x01, 0, 0};
+  unsigned expected_size = 6;
+  expected_size += right_keyboard.getButtons(0, 2, expected + expected_size);
+  expected[expected_size++] = 0xF7;
+  CHECK_EQUAL(host_sysex(get, sizeof(get), reply, sizeof(reply)),
+              expected_size);
+  CHECK(!memcmp(reply, expected, expected_size));
+
+  // Without the count (its place is the 0xF7), or past the last group
+  const byte error[] = {0xF0, 0x7D, 0x08, 0x7F, 0xF7};
+  const byte cut[] = {0xF0, 0x7D, 0x08, 0x01, 0x00, 0x00, 0xF7};
+  CHECK_EQUAL(host_sysex(cut, sizeof(cut), reply, sizeof(reply)), 5);
+  CHECK(!memcmp(reply, error, sizeof(error)));
+  const byte no_group[] = {0xF0, 0x7D, 0x08, 0x01, GROUP_COUNT, 0x00, 0x01,
+                           0xF7};
+  CHECK_EQUAL(host_sysex(no_group, sizeof(no_group), reply, sizeof(reply)),
+              5);
+  CHECK(!memcmp(reply, error, sizeof(error)));
+
+  return host_result();
+}
@@ -0,0 +1,118 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Chord shape pool: a layout or a 0x07 message whose chord shapes don't fit
+ * in the pool is rejected with an error and changes nothing, the shapes no
+ * button uses anymore are reused, and the shapes of a preset are kept.
+ */
+#include "host.h"
+
+/**
+ * Write count chord records of distinct shapes (first interval from
+ * first onward) to data. Return the bytes written.
+ */
+unsigned chords(byte *data, uint8_t first, uint8_t count)
+{
+  for(uint8_t i=0; i<count; i++) {
+    const byte record[] = {CHORD_BUTTON, 1, 48, 100,
+                           (byte)(first + i), 0, 0};
+    memcpy(data + i * sizeof(record), record, sizeof(record));
+  }
+  return count * MAX_BUTTON_RECORD;
+}
+
+/**
+ * Set buttons of the right keyboard from button 0 with a 0x07 SysEx.
+ * Return the status of the reply, 0x7F without one.
+ */
+byte set_right_buttons(const byte *records, unsigned size)
+{
+  byte message[SIM_SYSEX_SIZE] = {0xF0, 0x7D, 0x07, 0x01, 0x00, 0x00, 0x00};
+  memcpy(message + 7, records, size);
+  message[7 + size] = 0xF7;
+  byte reply[8];
+  if(host_sysex(message, 8 + size, reply, sizeof(reply)) != sizeof(reply))
+    return 0x7F;
+  return reply[5];
+}
+
+/**
+ * Send a whole layout of the right keyboard: a name, then records. Return
+ * true if it was answered with an error.
+ */
+bool send_layout(const byte *records, unsigned size)
+{
+  static byte message[1024];
+  const byte header[] = {0xF0, 0x7D, 0x02, 0x01, 'Q', 'Q', '=', '=', 0x00};
+  memcpy(message, header, sizeof(header));
+  memcpy(message + sizeof(header), records, size);
+  unsigned length = sizeof(header) + size;
+  // The other buttons are NullButtons
+  for(uint8_t i=size / MAX_BUTTON_RECORD; i<right_keyboard.buttonCount(); i++)
+    message[length++] = NULL_BUTTON;
+  message[length++] = 0xF7;
+  HostMidiLog log;
+  systemExclusiveHandler(message, length);
+  byte reply[5];
+  const byte error[] = {0xF0, 0x7D, 0x02, 0x7F, 0xF7};
+  return log.lastSysEx(0x02, reply, sizeof(reply)) == sizeof(error)
+         && !memcmp(reply, error, sizeof(error));
+}
+
+int main()
+{
+  setup();
+  byte records[CHORD_SHAPES * 2 * MAX_BUTTON_RECORD];
+  byte notes[CHORD_SHAPES * 4];
+  for(uint8_t i=0; i<CHORD_SHAPES; i++) {
+    const byte note[] = {NOTE_BUTTON, 1, (byte)(60 + i), 100};
+    memcpy(notes + 4 * i, note, sizeof(note));
+  }
+
+  // One shape more than the pool holds: nothing is set
+  const uint16_t checksum = right_keyboard.checksum();
+  CHECK_EQUAL(set_right_buttons(records, chords(records, 1, CHORD_SHAPES + 1)),
+              0x01);
+  CHECK_EQUAL(right_keyboard.checksum(), checksum);
+  CHECK(send_layout(records, chords(records, 1, CHORD_SHAPES + 1)));
+  CHECK_EQUAL(right_keyboard.checksum(), checksum);
+
+  // The whole pool, then other shapes once these are replaced
+  CHECK_EQUAL(set_right_buttons(records, chords(records, 1, CHORD_SHAPES)), 0x00);
+  CHECK_EQUAL(set_right_buttons(notes, sizeof(notes)), 0x00);
+  CHECK(!send_layout(records, chords(records, 21, CHORD_SHAPES)));
+  byte record[MAX_BUTTON_RECORD];
+  right_keyboard.getButtons(CHORD_SHAPES - 1, 1, record);
+  CHECK_EQUAL(record[0], CHORD_BUTTON);
+  CHECK_EQUAL(record[4], 21 + CHORD_SHAPES - 1);
+
+  // The shapes of a preset are kept after its buttons are replaced
+  const byte save[] = {0xF0, 0x7D, 0x04, 0x01, 0x00, 0xF7};
+  host_sysex(save, sizeof(save));
+  const uint16_t saved = right_keyboard.checksum();
+  CHECK_EQUAL(set_right_buttons(notes, sizeof(notes)), 0x00);
+  CHECK_EQUAL(set_right_buttons(records, chords(records, 41, 1)), 0x01);
+  const byte load[] = {0xF0, 0x7D, 0x05, 0x01, 0x00, 0xF7};
+  host_sysex(load, sizeof(load));
+  CHECK_EQUAL(right_keyboard.checksum(), saved);
+
+  return host_result();
+}
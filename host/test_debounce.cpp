@@ -0,0 +1,162 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Debouncing: contacts chattering for less than the debounce window give a
+ * single note-on and note-off per key, longer gaps are played, and a clean
+ * press is sent on the scan that sees it (fast-press mode). Also built with
+ * DEBOUNCE_PRESS_TICKS=3, where a short spike plays nothing.
+ */
+#include "host.h"
+
+// Time between two scans
+#define SCAN_US 100
+// Gaps that always stay under, or always go over, the release window
+#define SHORT_GAP_US ((DEBOUNCE_RELEASE_TICKS - 2) * DEBOUNCE_TICK_US)
+#define LONG_GAP_US ((DEBOUNCE_RELEASE_TICKS + 2) * DEBOUNCE_TICK_US)
+#define HOLD_US 50000
+
+uint32_t seed = 12345;
+unsigned long random_us(unsigned long low, unsigned long high)
+{
+  seed = seed * 1103515245 + 12345;
+  return low + (seed >> 8) % (high - low + 1);
+}
+
+/**
+ * Level of a key over time: (duration, level) segments, one after the
+ * other, then released.
+ */
+struct Contact
+{
+  unsigned long durations[32];
+  bool levels[32];
+  uint8_t count;
+
+  void add(unsigned long us, bool level)
+  {
+    durations[count] = us;
+    levels[count++] = level;
+  }
+  bool at(unsigned long t) const
+  {
+    for(uint8_t i=0; i<count; i++) {
+      if(t < durations[i])
+        return levels[i];
+      t -= durations[i];
+    }
+    return false;
+  }
+  unsigned long length() const
+  {
+    unsigned long sum = 0;
+    for(uint8_t i=0; i<count; i++)
+      sum += durations[i];
+    return sum;
+  }
+
+  /**
+   * A press and a release, each chattering for a while, with gaps shorter
+   * than the release window.
+   */
+  static Contact chattering()
+  {
+    Contact contact = {{0}, {false}, 0};
+    for(uint8_t i=0; i<5; i++) {
+      contact.add(random_us(SCAN_US, 900), true);
+      contact.add(random_us(SCAN_US, SHORT_GAP_US), false);
+    }
+    contact.add(HOLD_US, true);
+    for(uint8_t i=0; i<5; i++) {
+      contact.add(random_us(SCAN_US, SHORT_GAP_US), false);
+      contact.add(random_us(SCAN_US, 900), true);
+    }
+    return contact;
+  }
+};
+
+/**
+ * Play contacts on the keys of a group of the left keyboard, all at once,
+ * then wait until everything is released.
+ */
+void play(uint8_t group, const Contact *contacts, uint8_t keys)
+{
+  unsigned long length = 0;
+  for(uint8_t k=0; k<keys; k++)
+    length = max(length, contacts[k].length());
+  // In simulated time, which the scans themselves advance too
+  const unsigned long start = sim_micros;
+  while(sim_micros - start < length + HOLD_US) {
+    for(uint8_t k=0; k<keys; k++)
+      host_key(group, 8 + k, contacts[k].at(sim_micros - start));
+    host_run(1, SCAN_US);
+  }
+}
+
+int main()
+{
+  setup();
+  host_run(10);
+
+  // The 8 keys of the first left group play 8 different notes
+  HostMidiLog log;
+  for(int round=0; round<20; round++) {
+    Contact contacts[8];
+    for(uint8_t k=0; k<8; k++)
+      contacts[k] = Contact::chattering();
+    log.mark();
+    play(0, contacts, 8);
+    CHECK_EQUAL(log.noteOns(), 8);
+    CHECK_EQUAL(log.noteOffs(), 8);
+  }
+
+  // Gaps longer than the release window are real releases
+  Contact twice = {{0}, {false}, 0};
+  twice.add(20000, true);
+  twice.add(LONG_GAP_US, false);
+  twice.add(20000, true);
+  log.mark();
+  play(0, &twice, 1);
+  CHECK_EQUAL(log.noteOns(), 2);
+  CHECK_EQUAL(log.noteOffs(), 2);
+
+  // A single short spike
+  Contact spike = {{0}, {false}, 0};
+  spike.add(SCAN_US, true);
+  log.mark();
+  play(0, &spike, 1);
+  #if DEBOUNCE_PRESS_TICKS == 1
+  CHECK_EQUAL(log.noteOns(), 1);
+  CHECK_EQUAL(log.noteOffs(), 1);
+
+  // A clean press is sent by the very loop() that scans it
+  log.mark();
+  host_key(1, 8, true);
+  host_run(1, SCAN_US);
+  CHECK_EQUAL(log.noteOns(), 1);
+  host_key(1, 8, false);
+  host_run(HOLD_US / SCAN_US, SCAN_US);
+  #else
+  CHECK_EQUAL(log.noteOns(), 0);
+  CHECK_EQUAL(log.noteOffs(), 0);
+  #endif
+
+  return host_result();
+}
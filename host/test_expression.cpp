@@ -0,0 +1,125 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Bellows expression: a sweep of the bellows pressure reaches every
+ * expression target of the default layouts (3 of them), up to the full
+ * expression and back to 0, with the NRPN, 14-bit or 7-bit messages the
+ * build sends. With a controller burst too small for the message, the
+ * readings are counted as suppressed and the keys still play.
+ */
+#include "host.h"
+
+#if defined(EXPRESSION_NRPN)
+// Data entry LSB, the last controller of an NRPN update
+const uint8_t LAST_CONTROLLER = 38;
+#elif defined(EXPRESSION_14BIT)
+const uint8_t LAST_CONTROLLER = CC_Expression + 32;
+#else
+const uint8_t LAST_CONTROLLER = CC_Expression;
+#endif
+
+/**
+ * Last controller of an expression update sent to each channel (0 to 15),
+ * and the number of them.
+ */
+struct Updates
+{
+  unsigned long count[16];
+  uint8_t last[16];
+
+  void read(const HostMidiLog &log)
+  {
+    memset(this, 0, sizeof(*this));
+    log.parse([&](uint8_t status, unsigned long d1, unsigned long d2) {
+      if((status & 0xF0) == 0xB0 && d1 == LAST_CONTROLLER) {
+        count[status & 0x0F]++;
+        last[status & 0x0F] = d2;
+      }
+    });
+  }
+};
+
+/**
+ * Move the raw pressure of the sensor from from to to over us of
+ * simulated time.
+ */
+void sweep(uint32_t from, uint32_t to, unsigned long us)
+{
+  const unsigned long steps = us / 300;
+  for(unsigned long i=0; i<=steps; i++) {
+    sim_bmp180.up = from + ((long)to - (long)from) * (long)i / (long)steps;
+    host_run(1);
+  }
+}
+
+int main()
+{
+  setup();
+  const uint32_t ambient = sim_bmp180.up;
+  // Measure the ambient pressure (BELLOWS_AMBIENT_SAMPLES readings)
+  host_run(2000);
+
+  HostMidiLog log;
+  Updates updates;
+  // Push the bellows to well past full scale, hold, then release
+  sweep(ambient, ambient + 2000, 500000);
+  sweep(ambient + 2000, ambient + 2000, 200000);
+  updates.read(log);
+  const uint16_t suppressed = expression_controller.suppressedCount();
+
+  if(CONTROLLER_BURST_BYTES < expression_bytes()) {
+    // Nothing sent, every reading suppressed, and the keys still play
+    CHECK_EQUAL(updates.count[0] + updates.count[1] + updates.count[2], 0);
+    CHECK(suppressed > 0);
+    log.mark();
+    host_key(0, 0, true);
+    host_run(10);
+    CHECK_EQUAL(log.noteOns(), 1);
+    return host_result();
+  }
+
+  // Every target got updates, the melody reaching the full expression
+  for(uint8_t channel=0; channel<3; channel++)
+    CHECK(updates.count[channel] > 1);
+  #if defined(EXPRESSION_NRPN) || defined(EXPRESSION_14BIT)
+  CHECK_EQUAL(updates.last[0], 0x7F); // LSB of 16383
+  #else
+  CHECK_EQUAL(updates.last[0], 127);
+  #endif
+
+  sweep(ambient + 2000, ambient, 500000);
+  sweep(ambient, ambient, 200000);
+  updates.read(log);
+  for(uint8_t channel=0; channel<3; channel++)
+    CHECK_EQUAL(updates.last[channel], 0);
+
+  // A slow push of about 30 Pa, 4 steps of a 7-bit expression
+  log.mark();
+  sweep(ambient, ambient + 20, 1000000);
+  updates.read(log);
+  #if defined(EXPRESSION_NRPN) || defined(EXPRESSION_14BIT)
+  CHECK(updates.count[0] >= 10);
+  #else
+  CHECK(updates.count[0] <= 5);
+  #endif
+
+  return host_result();
+}
@@ -0,0 +1,63 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Keys held across a layout change: 48 keys of both keyboards are pressed,
+ * the right keyboard is switched to a register an octave up, then the keys
+ * are released. Every note-on gets its own note-off and no note is left
+ * sounding.
+ */
+#include "host.h"
+
+int main()
+{
+  setup();
+  HostMidiLog log;
+  // 3 groups of 16 keys, 8 on each keyboard
+  const uint8_t groups = 3;
+  for(uint8_t group=0; group<groups; group++) {
+    for(uint8_t index=0; index<16; index++)
+      host_key(group, index, true);
+  }
+  // Long enough for the UART to send them all
+  host_run(200);
+  const unsigned long on = log.noteOns();
+  CHECK(on > 16);
+  CHECK_EQUAL(midi_out.activeNotes().count(), on);
+  CHECK(held_buttons.heldCount() > 16);
+
+  // Register 1 filled from register 0 an octave up, and played
+  const byte shift[] = {0xF0, 0x7D, 0x0B, 0x01, 0x01, 0x00, 64 + 12, 0x00,
+                        0xF7};
+  host_sysex(shift, sizeof(shift));
+  CHECK_EQUAL(right_keyboard.activeRegister(), 1);
+
+  for(uint8_t group=0; group<groups; group++) {
+    for(uint8_t index=0; index<16; index++)
+      host_key(group, index, false);
+  }
+  host_run(200);
+  CHECK_EQUAL(log.noteOffs(), on);
+  CHECK_EQUAL(midi_out.activeNotes().count(), 0);
+  CHECK_EQUAL(midi_out.activeNotes().unmatchedOffs(), 0);
+  CHECK_EQUAL(held_buttons.heldCount(), 0);
+
+  return host_result();
+}
@@ -0,0 +1,112 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Layout round trip: a layout sent by Keyboard::send(), with a base64 or a
+ * packed name, decodes with LayoutDecoder to the same name, buttons and
+ * expression targets, for every button type.
+ */
+#include "host.h"
+
+/**
+ * What a layout decodes to.
+ */
+struct Layout
+{
+  unsigned char name[MAX_NAME_LENGTH];
+  Button buttons[MAX_KEYBOARD_BUTTONS];
+  ExpressionTarget expression[MAX_EXPRESSION_TARGETS];
+};
+
+/**
+ * Send the layout of keyboard and decode it back.
+ */
+unsigned round_trip(Keyboard &keyboard, bool packed, Layout &out)
+{
+  static byte sent[1024];
+  HostMidiLog log;
+  keyboard.send(packed);
+  const unsigned size = log.lastSysEx(0x02, sent, sizeof(sent));
+  memset(&out, 0, sizeof(out));
+  LayoutDecoder decoder;
+  decoder.begin(out.name, out.buttons, keyboard.buttonCount(),
+                out.expression);
+  // Skip the header, 0xF0 0x7D 0x02 type
+  decoder.feed(sent + 4, size - 4);
+  CHECK(decoder.done());
+  return size;
+}
+
+void check_same(Keyboard &keyboard, const Layout &layout)
+{
+  CHECK(!strcmp((const char*)layout.name, (const char*)keyboard.name));
+  for(uint8_t i=0; i<keyboard.buttonCount(); i++) {
+    byte expected[MAX_BUTTON_RECORD], decoded[MAX_BUTTON_RECORD];
+    const uint8_t len = keyboard.keyboard[i].toBytes(expected);
+    CHECK_EQUAL(layout.buttons[i].toBytes(decoded), len);
+    CHECK(!memcmp(decoded, expected, len));
+  }
+  CHECK(!memcmp(layout.expression, keyboard.expression,
+                sizeof(keyboard.expression)));
+}
+
+int main()
+{
+  setup();
+  Layout layout;
+
+  // The default layouts
+  for(int packed=0; packed<2; packed++) {
+    round_trip(right_keyboard, packed, layout);
+    check_same(right_keyboard, layout);
+    round_trip(left_keyboard, packed, layout);
+    check_same(left_keyboard, layout);
+  }
+
+  // Every button type, channel 16, and a name with 8-bit characters of
+  // every length up to the longest
+  const byte records[] = {
+    NOTE_BUTTON, 16, 60, 100,
+    PROGRAM_BUTTON, 1, 5,
+    CONTROL_BUTTON, 10, 64, 127,
+    PRESET_BUTTON, 0x02, 0x01,
+    PANIC_BUTTON,
+    REGISTER_BUTTON, 0x01, 0x01, 0x01,
+    CHORD_BUTTON, 3, 48, 90, 4, 7, 0,
+    NULL_BUTTON,
+  };
+  CHECK(right_keyboard.setButtons(0, records, sizeof(records)) > 0);
+  right_keyboard.expression[0] = {16, -12};
+  right_keyboard.expression[1] = {1, 63};
+  for(uint8_t len=0; len<MAX_NAME_LENGTH; len++) {
+    for(uint8_t i=0; i<len; i++)
+      right_keyboard.name[i] = 'A' + i % 26 + (i % 3 == 0 ? 0x80 : 0);
+    right_keyboard.name[len] = '\0';
+    const unsigned base64_size = round_trip(right_keyboard, false, layout);
+    check_same(right_keyboard, layout);
+    const unsigned packed_size = round_trip(right_keyboard, true, layout);
+    check_same(right_keyboard, layout);
+    // 8 bytes per 7 characters and 2 of header, against 4 per 3
+    if(len >= 16)
+      CHECK(packed_size < base64_size);
+  }
+
+  return host_result();
+}
@@ -0,0 +1,81 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Presets: switching presets while a note sounds doesn't write the EEPROM,
+ * the active slot is written once nothing sounds, and save and load
+ * messages that are cut or name no slot get an error reply.
+ */
+#include "host.h"
+
+int main()
+{
+  setup();
+  byte reply[16];
+
+  // Save the right layout to slots 0 then 1, the active one
+  const byte save0[] = {0xF0, 0x7D, 0x04, 0x01, 0x00, 0xF7};
+  const byte save1[] = {0xF0, 0x7D, 0x04, 0x01, 0x01, 0xF7};
+  CHECK(host_sysex(save0, sizeof(save0), reply, sizeof(reply)) == 0);
+  host_sysex(save1, sizeof(save1));
+  byte stored;
+  hal_eeprom_read(2, &stored, 1);
+  CHECK_EQUAL(stored, 1);
+
+  // Load slot 0 while a note sounds
+  host_key(0, 0, true);
+  host_run(10);
+  const unsigned long writes = sim_eeprom_writes;
+  HostMidiLog log;
+  const byte load0[] = {0xF0, 0x7D, 0x05, 0x01, 0x00, 0xF7};
+  host_sysex(load0, sizeof(load0));
+  CHECK(log.lastSysEx(0x06, reply, sizeof(reply)) > 6);
+  CHECK_EQUAL(reply[4], 0);
+  CHECK_EQUAL(reply[5], 0x03); // Used and active
+  host_run(100);
+  CHECK_EQUAL(sim_eeprom_writes, writes);
+  CHECK_EQUAL(presets.active(right_keyboard), 0);
+
+  // Written once the note is released
+  host_key(0, 0, false);
+  host_run(20);
+  CHECK_EQUAL(sim_eeprom_writes, writes + 1);
+  hal_eeprom_read(2, &stored, 1);
+  CHECK_EQUAL(stored, 0);
+  host_run(20);
+  CHECK_EQUAL(sim_eeprom_writes, writes + 1);
+
+  // Cut messages, no such keyboard or slot
+  const byte cut[] = {0xF0, 0x7D, 0x05, 0x01, 0xF7};
+  const byte no_keyboard[] = {0xF0, 0x7D, 0x05, 0x03, 0x00, 0xF7};
+  const byte no_slot[] = {0xF0, 0x7D, 0x04, 0x01, PRESET_SLOTS, 0xF7};
+  const byte error5[] = {0xF0, 0x7D, 0x05, 0x7F, 0xF7};
+  const byte error4[] = {0xF0, 0x7D, 0x04, 0x7F, 0xF7};
+  CHECK_EQUAL(host_sysex(cut, sizeof(cut), reply, sizeof(reply)), 5);
+  CHECK(!memcmp(reply, error5, sizeof(error5)));
+  CHECK_EQUAL(host_sysex(no_keyboard, sizeof(no_keyboard), reply,
+                         sizeof(reply)), 5);
+  CHECK(!memcmp(reply, error5, sizeof(error5)));
+  CHECK_EQUAL(host_sysex(no_slot, sizeof(no_slot), reply, sizeof(reply)), 5);
+  CHECK(!memcmp(reply, error4, sizeof(error4)));
+  CHECK_EQUAL(presets.active(right_keyboard), 0);
+
+  return host_result();
+}
@@ -0,0 +1,81 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Registers: a 0x0B SysEx selects a register, filling it from another one
+ * first if asked, and replies with the register played. A cut one, or one
+ * for a keyboard, register or channel that doesn't exist, gets an error
+ * reply and changes nothing.
+ */
+#include "host.h"
+
+int main()
+{
+  setup();
+  byte reply[16];
+  const byte error[] = {0xF0, 0x7D, 0x0B, 0x7F, 0xF7};
+
+  // Register 1 of the right keyboard filled from register 0 an octave up
+  const Button before = *right_keyboard.getButton(0, 0);
+  CHECK_EQUAL(before.type, NOTE_BUTTON);
+  const byte derive[] = {0xF0, 0x7D, 0x0B, 0x01, 0x01, 0x00, 64 + 12, 0x00,
+                         0xF7};
+  const byte selected[] = {0xF0, 0x7D, 0x0B, 0x01, 0x01, KEYBOARD_REGISTERS,
+                           0xF7};
+  CHECK_EQUAL(host_sysex(derive, sizeof(derive), reply, sizeof(reply)),
+              sizeof(selected));
+  CHECK(!memcmp(reply, selected, sizeof(selected)));
+  CHECK_EQUAL(right_keyboard.activeRegister(), 1);
+  CHECK_EQUAL(right_keyboard.getButton(0, 0)->message[1],
+              before.message[1] + 12);
+
+  // Back to register 0
+  const byte select[] = {0xF0, 0x7D, 0x0B, 0x01, 0x00, 0xF7};
+  CHECK_EQUAL(host_sysex(select, sizeof(select), reply, sizeof(reply)),
+              sizeof(selected));
+  CHECK_EQUAL(reply[4], 0);
+  CHECK_EQUAL(right_keyboard.activeRegister(), 0);
+
+  const byte cut[] = {0xF0, 0x7D, 0x0B, 0x01, 0xF7};
+  const byte no_keyboard[] = {0xF0, 0x7D, 0x0B, 0x03, 0x01, 0xF7};
+  const byte no_register[] = {0xF0, 0x7D, 0x0B, 0x01, KEYBOARD_REGISTERS,
+                              0xF7};
+  const byte no_source[] = {0xF0, 0x7D, 0x0B, 0x01, 0x01,
+                            KEYBOARD_REGISTERS, 64, 0x00, 0xF7};
+  const byte no_channel[] = {0xF0, 0x7D, 0x0B, 0x01, 0x01, 0x00, 64, 17,
+                             0xF7};
+  const byte *requests[] = {cut, no_keyboard, no_register, no_source,
+                            no_channel};
+  const unsigned sizes[] = {sizeof(cut), sizeof(no_keyboard),
+                            sizeof(no_register), sizeof(no_source),
+                            sizeof(no_channel)};
+  for(uint8_t i=0; i<5; i++) {
+    CHECK_EQUAL(host_sysex(requests[i], sizes[i], reply, sizeof(reply)),
+                sizeof(error));
+    CHECK(!memcmp(reply, error, sizeof(error)));
+    CHECK_EQUAL(right_keyboard.activeRegister(), 0);
+  }
+  // Register 1 was left as derived
+  CHECK(right_keyboard.selectRegister(1));
+  CHECK_EQUAL(right_keyboard.getButton(0, 0)->message[1],
+              before.message[1] + 12);
+
+  return host_result();
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * A key pressed then released sends its note-on then its note-off, on both
+ * keyboards, and nothing is sent while the keys don't move.
+ */
+#include "host.h"
+
+int main()
+{
+  setup();
+  host_run(10);
+
+  HostMidiLog log;
+  host_run(100);
+  CHECK_EQUAL(log.bytes(), 0);
+
+  // First key of the right keyboard: note 0x34 on channel 1
+  host_key(0, 0, true);
+  host_run(10);
+  CHECK_EQUAL(log.noteOns(), 1);
+  CHECK_EQUAL(log.byteAt(0), 0x90);
+  CHECK_EQUAL(log.byteAt(1), 0x34);
+  host_key(0, 0, false);
+  host_run(20);
+  CHECK_EQUAL(log.noteOffs(), 1);
+
+  // First key of the left keyboard: note 0x2c on channel 2
+  log.mark();
+  host_key(0, 8, true);
+  host_run(10);
+  host_key(0, 8, false);
+  host_run(20);
+  CHECK_EQUAL(log.noteOns(), 1);
+  CHECK_EQUAL(log.noteOffs(), 1);
+  CHECK_EQUAL(log.byteAt(0), 0x91);
+  CHECK_EQUAL(log.byteAt(1), 0x2c);
+
+  return host_result();
+}
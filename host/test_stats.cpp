@@ -0,0 +1,116 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Timing counters: the 0x0C reply has the layout send_stats() and
+ * Stats::report() describe, counts the scans and key events, and 0x01
+ * resets the counters once sent.
+ */
+#include "host.h"
+
+const unsigned REPLY_BYTES = 3 + STATS_REPORT_BYTES + 5*3 + 1;
+// Offsets of the counters in the reply
+const unsigned SCAN_MIN = 3;
+const unsigned SCAN_AVERAGE = 6;
+const unsigned SCAN_MAX = 9;
+const unsigned SCAN_COUNT = 12;
+const unsigned HISTOGRAM = 17;
+const unsigned EVENTS = HISTOGRAM + STATS_BUCKETS*3;
+const unsigned PEAK_EVENTS = EVENTS + 3;
+const unsigned BYTES_SENT = PEAK_EVENTS + 3;
+const unsigned SYSEX_COUNT = BYTES_SENT + 5;
+const unsigned PEAK_POLYPHONY = 3 + STATS_REPORT_BYTES + 3;
+
+/**
+ * Value of bytes 7-bit bytes at offset in the reply, low bits first.
+ */
+uint32_t get(const byte *reply, unsigned offset, uint8_t bytes)
+{
+  uint32_t value = 0;
+  for(uint8_t i=bytes; i>0; i--)
+    value = (value << 7) | reply[offset + i - 1];
+  return value;
+}
+
+/**
+ * Ask for the counters, resetting them once sent with reset.
+ */
+unsigned request(byte *reply, bool reset)
+{
+  const byte request[] = {0xF0, 0x7D, 0x0C, 0x01, 0xF7};
+  const byte plain[] = {0xF0, 0x7D, 0x0C, 0xF7};
+  return reset ? host_sysex(request, sizeof(request), reply, SIM_SYSEX_SIZE)
+               : host_sysex(plain, sizeof(plain), reply, SIM_SYSEX_SIZE);
+}
+
+int main()
+{
+  setup();
+  host_run(100);
+  // 4 keys pressed together, then released: 8 key events
+  HostMidiLog log;
+  for(uint8_t index=0; index<4; index++)
+    host_key(0, index, true);
+  host_run(50);
+  const unsigned long notes = log.noteOns();
+  CHECK(notes > 1);
+  for(uint8_t index=0; index<4; index++)
+    host_key(0, index, false);
+  // Past the second the events happened in
+  host_run(4000);
+
+  byte reply[SIM_SYSEX_SIZE];
+  CHECK_EQUAL(request(reply, false), REPLY_BYTES);
+  CHECK_EQUAL(reply[REPLY_BYTES - 1], 0xF7);
+  for(unsigned i=3; i<REPLY_BYTES - 1; i++)
+    CHECK(reply[i] < 0x80);
+
+  const uint32_t scans = get(reply, SCAN_COUNT, 5);
+  CHECK(scans > 100);
+  CHECK(get(reply, SCAN_MIN, 3) > 0);
+  CHECK(get(reply, SCAN_MIN, 3) <= get(reply, SCAN_AVERAGE, 3));
+  CHECK(get(reply, SCAN_AVERAGE, 3) <= get(reply, SCAN_MAX, 3));
+  uint32_t latencies = 0;
+  for(uint8_t i=0; i<STATS_BUCKETS; i++)
+    latencies += get(reply, HISTOGRAM + 3*i, 3);
+  CHECK(latencies >= 2); // At least the first press and the first release
+  CHECK_EQUAL(get(reply, EVENTS, 3), 8);
+  CHECK_EQUAL(get(reply, PEAK_EVENTS, 3), 8);
+  CHECK(get(reply, BYTES_SENT, 5) >= 8 * 2);
+  CHECK_EQUAL(get(reply, PEAK_POLYPHONY, 3), notes);
+
+  // The counters go on until reset
+  host_run(100);
+  CHECK_EQUAL(request(reply, true), REPLY_BYTES);
+  CHECK(get(reply, SCAN_COUNT, 5) > scans);
+  CHECK(get(reply, SYSEX_COUNT, 3) >= 1);
+
+  // Reset once sent: only the request itself was counted since
+  CHECK_EQUAL(request(reply, false), REPLY_BYTES);
+  CHECK_EQUAL(get(reply, SCAN_COUNT, 5), 0);
+  CHECK_EQUAL(get(reply, SCAN_MAX, 3), 0);
+  for(uint8_t i=0; i<STATS_BUCKETS; i++)
+    CHECK_EQUAL(get(reply, HISTOGRAM + 3*i, 3), 0);
+  CHECK_EQUAL(get(reply, EVENTS, 3), 0);
+  CHECK_EQUAL(get(reply, PEAK_EVENTS, 3), 0);
+  CHECK_EQUAL(get(reply, SYSEX_COUNT, 3), 1);
+
+  return host_result();
+}
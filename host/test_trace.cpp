@@ -0,0 +1,158 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Event trace: the 0x0D dump of a key pressed and released holds, in
+ * order, its raw reading, debounced event and MIDI message, queued then
+ * sent. Records the scan interrupt adds while the dump is being sent are
+ * counted as lost.
+ *
+ * Given a file name, the dump is also written there as a .syx file, for
+ * tools/trace_decode.py to be checked against it.
+ */
+#include "host.h"
+
+/**
+ * A record decoded as tools/trace_decode.py does.
+ */
+struct Record
+{
+  uint16_t delta;
+  uint8_t kind;
+  uint8_t data[2];
+};
+
+struct Dump
+{
+  byte bytes[16 + 6 * TRACE_SIZE];
+  unsigned size;
+  uint32_t count;
+  uint32_t lost;
+  Record records[TRACE_SIZE];
+
+  /**
+   * Ask for the trace, clearing it once sent with clear, and decode it.
+   */
+  void request(bool clear)
+  {
+    const byte request[] = {0xF0, 0x7D, 0x0D, 0x01, 0xF7};
+    const byte plain[] = {0xF0, 0x7D, 0x0D, 0xF7};
+    size = clear ? host_sysex(request, sizeof(request), bytes, sizeof(bytes))
+                 : host_sysex(plain, sizeof(plain), bytes, sizeof(bytes));
+    count = bytes[3] | bytes[4] << 7 | (uint32_t)bytes[5] << 14;
+    lost = bytes[6] | bytes[7] << 7 | (uint32_t)bytes[8] << 14;
+    CHECK_EQUAL(size, 9 + 6 * count + 1);
+    for(uint32_t i=0; i<count && i<TRACE_SIZE; i++) {
+      const byte *p = bytes + 9 + 6 * i;
+      byte raw[5];
+      for(uint8_t j=0; j<5; j++)
+        raw[j] = p[1 + j] | ((p[0] >> j) & 1) << 7;
+      records[i] = {(uint16_t)(raw[0] | raw[1] << 8), raw[2],
+                    {raw[3], raw[4]}};
+    }
+  }
+  /**
+   * Index of the first record of kind with data0 from index on, count if
+   * there is none.
+   */
+  uint32_t find(uint32_t from, uint8_t kind, uint8_t data0) const
+  {
+    while(from < count && (records[from].kind != kind
+                           || records[from].data[0] != data0))
+      from++;
+    return from;
+  }
+};
+
+void add_from_interrupt()
+{
+  trace.add(TRACE_RAW_PRESS, 0);
+}
+
+int main(int argc, char **argv)
+{
+  setup();
+  host_run(100);
+  Dump dump;
+  dump.request(true);
+
+  // Key 2 of group 1, on the right keyboard
+  const uint8_t key = 1 * MATRIX_COLUMNS + 2;
+  const Button &button = *right_keyboard.getButton(1, 2);
+  CHECK_EQUAL(button.type, NOTE_BUTTON);
+  host_key(1, 2, true);
+  host_run(50);
+  host_key(1, 2, false);
+  host_run(50);
+
+  dump.request(false);
+  CHECK_EQUAL(dump.lost, 0);
+  const uint32_t raw_press = dump.find(0, TRACE_RAW_PRESS, key);
+  const uint32_t press = dump.find(raw_press, TRACE_KEY_PRESS, key);
+  const uint32_t queued = dump.find(press, TRACE_MIDI_QUEUED,
+                                    button.message[0]);
+  const uint32_t sent = dump.find(queued, TRACE_MIDI_SENT, button.message[0]);
+  const uint32_t raw_release = dump.find(sent, TRACE_RAW_RELEASE, key);
+  const uint32_t release = dump.find(raw_release, TRACE_KEY_RELEASE, key);
+  CHECK(release < dump.count);
+  CHECK_EQUAL(dump.records[queued].data[1], button.message[1]);
+  CHECK_EQUAL(dump.records[sent].data[1], button.message[1]);
+  // The note-off follows the release
+  uint32_t off = release + 1;
+  while(off < dump.count && !(dump.records[off].kind == TRACE_MIDI_SENT
+        && (dump.records[off].data[0] & 0x0F) == (button.message[0] & 0x0F)
+        && dump.records[off].data[1] == button.message[1]))
+    off++;
+  CHECK(off < dump.count);
+  // The SysEx asking for the dump comes last
+  CHECK_EQUAL(dump.records[dump.count - 1].kind, TRACE_SYSEX);
+  // Debounced after the raw reading, sent within a few loops
+  uint32_t press_us = 0;
+  for(uint32_t i=raw_press + 1; i<=press; i++)
+    press_us += dump.records[i].delta;
+  CHECK(press_us > 0);
+  uint32_t send_us = 0;
+  for(uint32_t i=press + 1; i<=sent; i++)
+    send_us += dump.records[i].delta;
+  CHECK(send_us < 10 * 300);
+
+  if(argc > 1) {
+    FILE *file = fopen(argv[1], "wb");
+    CHECK(file != nullptr);
+    if(file) {
+      fwrite(dump.bytes, 1, dump.size, file);
+      fclose(file);
+    }
+  }
+
+  // The scan interrupt adds records while the dump waits for the UART
+  Serial.sim_on_wait = add_from_interrupt;
+  dump.request(true);
+  Serial.sim_on_wait = nullptr;
+  const uint32_t sent_count = dump.count;
+  CHECK(sent_count > 0);
+  CHECK_EQUAL(dump.lost, 0);
+  // Cleared, but the records lost while sending are still reported
+  dump.request(false);
+  CHECK(dump.lost > 0);
+  CHECK_EQUAL(dump.count, 1); // The request itself
+
+  return host_result();
+}
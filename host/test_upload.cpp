@@ -0,0 +1,227 @@
+/*******************************************************************************
+  Accordion MIDI - Arduino
+  https://github.com/SimonVareille/AccordionMIDI-Arduino
+  Copyright © 2021 Simon Vareille
+
+  Based on projects byBrendan Vavra 2016-2017, Dimon Yegorenkov 2011 and Jason Bugeja 2014
+ *******************************************************************************
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+/*
+ * Layout upload over the simulated serial line: a host sends the default
+ * right layout with go-back-N (see LayoutUpload) while chunks are dropped
+ * or corrupted on the way, replies are lost, and the firmware stops
+ * reading for as long as a full window takes to arrive. The upload must
+ * end with UPLOAD_DONE, the layout checksum must be the one of the layout
+ * sent, and without faults a full window must never overrun the RX buffer.
+ * (After a NAK, the chunks still on the line and the window sent again can
+ * overrun it: that is one more loss the retransmission recovers from.)
+ *
+ * When the UPLOAD_DONE reply is lost, the host only gets UPLOAD_ERROR for
+ * the last chunk it sends again. It then asks for the layout checksum
+ * (0x09) and compares it with the one of the layout it sent, as an editor
+ * does.
+ */
+#include "host.h"
+
+// Time without a reply after which the host sends the window again
+#define HOST_TIMEOUT_US 50000
+
+/**
+ * Faults of the line, in percent of the messages.
+ */
+struct Faults
+{
+  int dropped;     // Chunks lost
+  int corrupted;   // Chunks with a payload byte changed
+  int lost_replies; // Replies the host never sees
+  bool busy;       // The firmware doesn't read while a window arrives
+};
+
+/**
+ * Replies written by the firmware since the last call.
+ */
+class Replies
+{
+  public:
+    Replies() : read(Serial.tx_len), length(0) {}
+    /**
+     * Copy the next reply with the command (F0 7D command ...) to reply, 8
+     * bytes at most. Return false if there is none.
+     */
+    bool next(byte *reply, byte command = 0x12)
+    {
+      while(read < Serial.tx_len) {
+        const byte b = Serial.sim_tx[read++ % SIM_TX_SIZE];
+        if(b == 0xF0)
+          length = 0;
+        if(length < sizeof(message))
+          message[length++] = b;
+        if(b == 0xF7 && length >= 6 && message[2] == command) {
+          memcpy(reply, message, length);
+          return true;
+        }
+      }
+      return false;
+    }
+  private:
+    unsigned long read;
+    byte message[8];
+    unsigned length;
+};
+
+/**
+ * Send chunk seq of body, of payload bytes at most, maybe damaged.
+ */
+void send_chunk(const byte *body, unsigned size, unsigned seq,
+                unsigned payload, const Faults &faults)
+{
+  byte message[UPLOAD_CHUNK_OVERHEAD + UPLOAD_CHUNK_BYTES] =
+    {0xF0, 0x7D, 0x11, (byte)(seq & 0x7F)};
+  const unsigned start = seq * payload;
+  const unsigned length = min(payload, size - start);
+  memcpy(message + 4, body + start, length);
+  uint16_t crc = crc16_update(CRC16_INIT, message[3]);
+  for(unsigned i=0; i<length; i++)
+    crc = crc16_update(crc, body[start + i]);
+  crc16_to_sysex(crc, message + 4 + length);
+  message[7 + length] = 0xF7;
+  if(rand() % 100 < faults.dropped)
+    return;
+  if(rand() % 100 < faults.corrupted)
+    message[4 + rand() % length] ^= 0x01;
+  Serial.sim_send(message, length + UPLOAD_CHUNK_OVERHEAD);
+}
+
+/**
+ * Ask for the checksum of the right layout over the line.
+ */
+uint16_t line_checksum()
+{
+  Replies replies;
+  byte reply[8];
+  const byte query[] = {0xF0, 0x7D, 0x09, 0x01, 0xF7};
+  Serial.sim_send(query, sizeof(query));
+  while(!replies.next(reply, 0x09))
+    host_run(1);
+  return reply[4] << 14 | reply[5] << 7 | reply[6];
+}
+
+/**
+ * Upload body, whose layout has the given checksum, to the right keyboard.
+ * Return the number of chunks sent, 0 if the upload failed or took more
+ * than a second of simulated time.
+ */
+unsigned upload(const byte *body, unsigned size, uint16_t checksum,
+                const Faults &faults)
+{
+  Replies replies;
+  byte reply[8];
+  const byte begin[] = {0xF0, 0x7D, 0x10, 0x01, (byte)(size & 0x7F),
+                        (byte)(size >> 7), 0xF7};
+  Serial.sim_send(begin, sizeof(begin));
+  while(!replies.next(reply))
+    host_run(1);
+  CHECK_EQUAL(reply[3], UPLOAD_READY);
+  CHECK_EQUAL(reply[4], UPLOAD_WINDOW);
+  CHECK_EQUAL(reply[5], UPLOAD_CHUNK_BYTES);
+  const unsigned window = reply[4], payload = reply[5];
+  const unsigned chunks = (size + payload - 1) / payload;
+
+  const unsigned long start = sim_micros;
+  unsigned long last_reply = sim_micros;
+  unsigned base = 0, next = 0, sent = 0;
+  while(sim_micros - start < 1000000) {
+    unsigned bytes = 0;
+    for(; next < chunks && next < base + window; next++, sent++) {
+      send_chunk(body, size, next, payload, faults);
+      bytes += UPLOAD_CHUNK_OVERHEAD + payload;
+    }
+    // Busy with something else until the whole window arrived
+    if(faults.busy && bytes)
+      sim_micros += (bytes + 1) * SIM_BYTE_US;
+    host_run(1);
+    while(replies.next(reply)) {
+      if(rand() % 100 < faults.lost_replies)
+        continue;
+      last_reply = sim_micros;
+      // Sequence numbers wrap at 128, the base is at most a window behind
+      const unsigned seq = base + ((reply[4] - base) & 0x7F);
+      if(reply[3] == UPLOAD_ACK)
+        base = max(base, seq + 1);
+      else if(reply[3] == UPLOAD_NAK)
+        base = next = seq;
+      else if(reply[3] == UPLOAD_DONE)
+        return sent;
+      else if(next == chunks) // Maybe done, and its reply lost
+        return line_checksum() == checksum ? sent : 0;
+      else
+        return 0;
+    }
+    if(sim_micros - last_reply > HOST_TIMEOUT_US) {
+      // Go back to the first chunk not acknowledged
+      next = base;
+      last_reply = sim_micros;
+    }
+  }
+  return 0;
+}
+
+int main()
+{
+  setup();
+  host_run(5);
+  static byte layout[1024];
+  HostMidiLog log;
+  right_keyboard.send(false);
+  const unsigned size = log.lastSysEx(0x02, layout, sizeof(layout));
+  // What follows F0 7D 02 type, without the F7
+  const byte *body = layout + 4;
+  const unsigned body_size = size - 5;
+  const uint16_t checksum = right_keyboard.checksum();
+
+  const Faults cases[] = {
+    {0, 0, 0, false},
+    {0, 0, 0, true},
+    {10, 0, 0, false},
+    {0, 10, 0, false},
+    {0, 0, 20, false},
+    {10, 10, 10, true},
+  };
+  srand(1);
+  for(const Faults &faults : cases) {
+    for(int run=0; run<10; run++) {
+      // Change the first button, the upload puts it back
+      const byte change[] = {0xF0, 0x7D, 0x07, 0x01, 0x00, 0x00, 0x00,
+                             NOTE_BUTTON, 0x02, 0x30, 0x40, 0xF7};
+      host_sysex(change, sizeof(change));
+      CHECK(right_keyboard.checksum() != checksum);
+      const unsigned long overruns = Serial.rx_overruns;
+      const unsigned sent = upload(body, body_size, checksum, faults);
+      CHECK(sent > 0);
+      CHECK_EQUAL(right_keyboard.checksum(), checksum);
+      if(!faults.dropped && !faults.corrupted && !faults.lost_replies)
+        CHECK_EQUAL(Serial.rx_overruns, overruns);
+      // Let the line and the replies settle
+      host_run(200);
+      if(host_failures) {
+        printf("faults %d %d %d %d, run %d\n", faults.dropped,
+               faults.corrupted, faults.lost_replies, faults.busy, run);
+        return host_result();
+      }
+    }
+  }
+
+  return host_result();
+}
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+# Accordion MIDI - Arduino
+# https://github.com/SimonVareille/AccordionMIDI-Arduino
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+"""Turn the trace dumped by the 0x0D SysEx (firmware built with TRACE) into
+a timeline.
+
+The input is the SysEx reply, either as raw bytes (a .syx file) or as
+hexadecimal text ("F0 7D 0D ..."). Usage:
+
+    trace_decode.py dump.syx
+    amidi -p hw:1 -S 'F0 7D 0D F7' -r dump.syx -t 2 && trace_decode.py dump.syx
+"""
+import string
+import sys
+
+MATRIX_COLUMNS = 16
+LEFT_COLUMN = 8
+
+KINDS = {
+    0x01: "raw press",
+    0x02: "raw release",
+    0x03: "key press",
+    0x04: "key release",
+    0x05: "MIDI queued",
+    0x06: "MIDI sent",
+    0x07: "SysEx chunk",
+}
+
+
+def read_input(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    text = data.decode("ascii", "ignore")
+    if text and all(c in string.hexdigits or c.isspace() or c == ","
+                    for c in text):
+        return bytes.fromhex(text.replace(",", " "))
+    return data
+
+
+def find_dump(data):
+    start = data.find(b"\xf0\x7d\x0d")
+    if start < 0:
+        sys.exit("no 0x0D trace SysEx found")
+    end = data.find(b"\xf7", start)
+    if end < 0:
+        sys.exit("trace SysEx is cut")
+    return data[start + 3:end]
+
+
+def value7(data):
+    value = 0
+    for i, b in enumerate(data):
+        value |= b << (7 * i)
+    return value
+
+
+def records(body):
+    for i in range(0, len(body) - len(body) % 6, 6):
+        high = body[i]
+        raw = [b | (((high >> j) & 1) << 7)
+               for j, b in enumerate(body[i + 1:i + 6])]
+        yield raw[0] | raw[1] << 8, raw[2], raw[3], raw[4]
+
+
+def key_name(key):
+    group, column = divmod(key, MATRIX_COLUMNS)
+    if column < LEFT_COLUMN:
+        return "right g%d k%d" % (group, column)
+    return "left g%d k%d" % (group, column - LEFT_COLUMN)
+
+
+def midi_name(status, data):
+    channel = (status & 0x0F) + 1
+    kind = status & 0xF0
+    if kind == 0x90:
+        return "note on  ch%d %d" % (channel, data)
+    if kind == 0x80:
+        return "note off ch%d %d" % (channel, data)
+    if kind == 0xB0:
+        return "CC ch%d %d" % (channel, data)
+    if kind == 0xC0:
+        return "program ch%d %d" % (channel, data)
+    if kind == 0xE0:
+        return "pitch bend ch%d" % channel
+    return "status %02X" % status
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    body = find_dump(read_input(sys.argv[1]))
+    if len(body) < 6:
+        print("empty trace (firmware built without TRACE?)")
+        return
+    count, lost = value7(body[0:3]), value7(body[3:6])
+    print("%d records, %d lost before them" % (count, lost))
+    time = 0
+    for n, (delta, kind, d0, d1) in enumerate(records(body[6:])):
+        if n:
+            time += delta
+        late = "+" if delta == 0xFFFF else " "
+        if kind in (0x01, 0x02, 0x03, 0x04):
+            detail = key_name(d0)
+        elif kind in (0x05, 0x06):
+            detail = midi_name(d0, d1)
+        elif kind == 0x07:
+            detail = "%s, %d bytes" % ("start" if d0 == 0xF0 else "next", d1)
+        else:
+            detail = "%02X %02X" % (d0, d1)
+        print("%10d us %6d%s %-12s %s" % (time, delta, late,
+                                          KINDS.get(kind, "kind %02X" % kind),
+                                          detail))
+
+
+if __name__ == "__main__":
+    main()